@@ -0,0 +1,55 @@
+//--------------------------------- ASSET PACK FORMAT --------------------------------
+// Shared by the game and asset_packer. A pack is a header, a table of
+// entries and their data, each aligned so it can be used in place once
+// the file is memory mapped. Fields are in the byte order of the machine
+// that built the pack.
+
+#ifndef ASSET_PACK_H
+#define ASSET_PACK_H
+
+#include <SDL2/SDL.h>
+
+// "DHPK"
+#define ASSET_PACK_MAGIC 0x4b504844
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_NAME_SIZE 32
+// Entry data alignment, a cache line
+#define ASSET_PACK_ALIGN 64
+
+// Format images are stored in, the native one of the usual renderers
+#define ASSET_PACK_PIXEL_FORMAT SDL_PIXELFORMAT_ARGB8888
+// Format sounds are stored in, the one the game opens the mixer with
+#define ASSET_PACK_FREQUENCY 22050
+#define ASSET_PACK_AUDIO_FORMAT AUDIO_S16SYS
+#define ASSET_PACK_CHANNELS 2
+
+enum asset_pack_type
+{
+  // Decoded pixels, params: width, height, pitch, pixel format
+  ASSET_PACK_IMAGE,
+  // Converted samples, params: frequency, audio format, channels
+  ASSET_PACK_SOUND,
+  // File copied as is, e.g. fonts
+  ASSET_PACK_FILE
+};
+
+struct asset_pack_header
+{
+  Uint32 magic;
+  Uint32 version;
+  Uint32 count;
+  Uint32 reserved;
+};
+
+struct asset_pack_entry
+{
+  // Loose file name the entry replaces
+  char name[ASSET_PACK_NAME_SIZE];
+  Uint32 type;
+  // Data position from the start of the pack
+  Uint32 offset;
+  Uint32 size;
+  Uint32 params[4];
+};
+
+#endif
@@ -0,0 +1,218 @@
+//--------------------------------- ASSET PACKER --------------------------------
+// Builds the pack duck_hunter maps at startup: PNGs are decoded to the
+// texture pixel format and WAVs converted to the mixer output format, so
+// the game only has to point at them.
+//
+// Usage: asset_packer output.pack file...
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <stdio.h>
+#include <string.h>
+#include "asset_pack.h"
+
+#define PACK_ENTRIES_SIZE 64
+
+struct asset_pack_header header;
+struct asset_pack_entry entries[PACK_ENTRIES_SIZE];
+// Data of each entry, written after the table
+void *entries_data[PACK_ENTRIES_SIZE];
+
+void pack_image(struct asset_pack_entry *entry, void **data, char *path);
+void pack_sound(struct asset_pack_entry *entry, void **data, char *path);
+void pack_file(struct asset_pack_entry *entry, void **data, char *path);
+int has_extension(char *path, char *extension);
+Uint32 align(Uint32 offset);
+
+int main(int argc, char* args[])
+{
+  FILE *file;
+  Uint32 offset;
+  char zeros[ASSET_PACK_ALIGN];
+  int i;
+
+  if(argc<3)
+  {
+    printf("Usage: %s output.pack file...\n", args[0]);
+    exit(-1);
+  }
+  if(argc-2 > PACK_ENTRIES_SIZE)
+  {
+    printf("Too many files, a pack holds %d\n", PACK_ENTRIES_SIZE);
+    exit(-1);
+  }
+
+  //Initialize PNG loading
+  if( !( IMG_Init( IMG_INIT_PNG ) & IMG_INIT_PNG ) )
+  {
+    printf( "SDL_image could not initialize! SDL_image Error: %s\n", IMG_GetError() );
+    exit(-1);
+  }
+
+  header.magic=ASSET_PACK_MAGIC;
+  header.version=ASSET_PACK_VERSION;
+  header.count=argc-2;
+  header.reserved=0;
+
+  // Convert every file, data goes after the header and table
+  offset=align(sizeof(struct asset_pack_header) + header.count*sizeof(struct asset_pack_entry));
+  for(i=0; i<(int)header.count; i++)
+  {
+    if(strlen(args[i+2]) >= ASSET_PACK_NAME_SIZE)
+    {
+      printf("File name %s too long for a pack entry\n", args[i+2]);
+      exit(-1);
+    }
+    memset(&entries[i], 0, sizeof(struct asset_pack_entry));
+    strcpy(entries[i].name, args[i+2]);
+    if(has_extension(args[i+2], ".png"))
+    {
+      pack_image(&entries[i], &entries_data[i], args[i+2]);
+    }
+    else if(has_extension(args[i+2], ".wav"))
+    {
+      pack_sound(&entries[i], &entries_data[i], args[i+2]);
+    }
+    else
+    {
+      pack_file(&entries[i], &entries_data[i], args[i+2]);
+    }
+    entries[i].offset=offset;
+    offset=align(offset+entries[i].size);
+    printf("%-24s %8u bytes\n", entries[i].name, entries[i].size);
+  }
+
+  // Write header, table and aligned data
+  file=fopen(args[1], "wb");
+  if(file == NULL)
+  {
+    printf("Unable to create %s\n", args[1]);
+    exit(-1);
+  }
+  memset(zeros, 0, sizeof(zeros));
+  fwrite(&header, sizeof(struct asset_pack_header), 1, file);
+  fwrite(entries, sizeof(struct asset_pack_entry), header.count, file);
+  for(i=0; i<(int)header.count; i++)
+  {
+    fwrite(zeros, 1, entries[i].offset-ftell(file), file);
+    fwrite(entries_data[i], 1, entries[i].size, file);
+    SDL_free(entries_data[i]);
+  }
+  fwrite(zeros, 1, offset-ftell(file), file);
+  if(fclose(file) != 0)
+  {
+    printf("Unable to write %s\n", args[1]);
+    exit(-1);
+  }
+  printf("%s: %u entries, %u bytes\n", args[1], header.count, offset);
+
+  IMG_Quit();
+  return 0;
+}
+
+void pack_image(struct asset_pack_entry *entry, void **data, char *path)
+{
+  SDL_Surface *loaded_surface;
+  SDL_Surface *surface;
+
+  loaded_surface=IMG_Load(path);
+  if(loaded_surface == NULL)
+  {
+    printf( "Unable to load image %s! SDL_image Error: %s\n", path, IMG_GetError() );
+    exit(-1);
+  }
+  // Colour keys become alpha in the conversion
+  surface=SDL_ConvertSurfaceFormat(loaded_surface, ASSET_PACK_PIXEL_FORMAT, 0);
+  SDL_FreeSurface(loaded_surface);
+  if(surface == NULL)
+  {
+    printf( "Unable to convert image %s! SDL Error: %s\n", path, SDL_GetError() );
+    exit(-1);
+  }
+
+  entry->type=ASSET_PACK_IMAGE;
+  entry->size=surface->pitch*surface->h;
+  entry->params[0]=surface->w;
+  entry->params[1]=surface->h;
+  entry->params[2]=surface->pitch;
+  entry->params[3]=ASSET_PACK_PIXEL_FORMAT;
+  *data=SDL_malloc(entry->size);
+  if(*data == NULL)
+  {
+    printf("Unable to allocate %u bytes for %s\n", entry->size, path);
+    exit(-1);
+  }
+  memcpy(*data, surface->pixels, entry->size);
+  SDL_FreeSurface(surface);
+}
+
+void pack_sound(struct asset_pack_entry *entry, void **data, char *path)
+{
+  SDL_AudioSpec spec;
+  SDL_AudioCVT cvt;
+  Uint8 *samples;
+  Uint32 length;
+
+  if(SDL_LoadWAV(path, &spec, &samples, &length) == NULL)
+  {
+    printf( "Unable to load sound %s! SDL Error: %s\n", path, SDL_GetError() );
+    exit(-1);
+  }
+
+  // Same conversion SDL_mixer would do at every start
+  if(SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq,
+		       ASSET_PACK_AUDIO_FORMAT, ASSET_PACK_CHANNELS, ASSET_PACK_FREQUENCY) < 0)
+  {
+    printf( "Unable to convert sound %s! SDL Error: %s\n", path, SDL_GetError() );
+    exit(-1);
+  }
+  cvt.len=length;
+  cvt.buf=SDL_malloc(length*cvt.len_mult);
+  if(cvt.buf == NULL)
+  {
+    printf("Unable to allocate %u bytes for %s\n", length*cvt.len_mult, path);
+    exit(-1);
+  }
+  memcpy(cvt.buf, samples, length);
+  SDL_FreeWAV(samples);
+  if(cvt.needed && SDL_ConvertAudio(&cvt) < 0)
+  {
+    printf( "Unable to convert sound %s! SDL Error: %s\n", path, SDL_GetError() );
+    exit(-1);
+  }
+
+  entry->type=ASSET_PACK_SOUND;
+  entry->size=cvt.needed ? cvt.len_cvt : length;
+  entry->params[0]=ASSET_PACK_FREQUENCY;
+  entry->params[1]=ASSET_PACK_AUDIO_FORMAT;
+  entry->params[2]=ASSET_PACK_CHANNELS;
+  *data=cvt.buf;
+}
+
+void pack_file(struct asset_pack_entry *entry, void **data, char *path)
+{
+  size_t size;
+
+  *data=SDL_LoadFile(path, &size);
+  if(*data == NULL)
+  {
+    printf( "Unable to load %s! SDL Error: %s\n", path, SDL_GetError() );
+    exit(-1);
+  }
+  entry->type=ASSET_PACK_FILE;
+  entry->size=size;
+}
+
+int has_extension(char *path, char *extension)
+{
+  size_t length, extension_length;
+
+  length=strlen(path);
+  extension_length=strlen(extension);
+  return length>=extension_length && SDL_strcasecmp(path+length-extension_length, extension)==0;
+}
+
+Uint32 align(Uint32 offset)
+{
+  return (offset + ASSET_PACK_ALIGN-1) & ~(Uint32)(ASSET_PACK_ALIGN-1);
+}
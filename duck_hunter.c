@@ -5,8 +5,17 @@
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+// pause() would clash with the pause flag, it is not used
+#define pause unistd_pause
+#include <unistd.h>
+#undef pause
+#include "asset_pack.h"
 
 #define FULL_SCREEN 1 
 #define BUTTON_A 1
@@ -20,6 +29,92 @@
 #define BUTTON_SELECT 8
 #define BUTTON_START 9
 
+// Simulation rate game constants are expressed in
+#define SIM_BASE_RATE 50
+// Default render rate
+#define RENDER_RATE 50
+// Ticks run per rendered frame before dropping time
+#define MAX_TICKS_PER_FRAME 5
+// Inputs queued by the input thread for the simulation thread
+#define INPUT_QUEUE_SIZE 1024
+// Players and controllers supported
+#define MAX_PLAYERS 8
+#define MAX_CONTROLLERS 8
+// Buttons and axes the input thread watches
+#define INPUT_BUTTONS 16
+#define INPUT_AXES 8
+// Sub-tick position of an input, in 1/INPUT_PHASES of a tick
+#define INPUT_PHASES 256
+// Set on the newest snapshot slot until the renderer takes it
+#define SNAPSHOT_FRESH 4
+
+// Printable ASCII range rasterised into the glyph atlases
+#define GLYPH_FIRST 32
+#define GLYPH_LAST 126
+#define GLYPH_COUNT (GLYPH_LAST-GLYPH_FIRST+1)
+#define GLYPH_ATLAS_WIDTH 1024
+// Quads submitted per SDL_RenderGeometry call when drawing text
+#define QUAD_BATCH_SIZE 256
+// Static strings cached as ready-made textures
+#define TEXT_CACHE_SIZE 32
+// Images packed into a single texture at load time
+#define IMAGE_ATLAS_SIZE 32
+#define IMAGE_ATLAS_WIDTH 512
+#define IMAGE_ATLAS_PADDING 1
+// Assets decoded by the loader workers
+#define ASSET_JOBS_SIZE 32
+#define ASSET_WORKERS_MAX 4
+// Alignment of arena allocations, a cache line
+#define ARENA_ALIGN 64
+// Steps kept for the startup report
+#define STARTUP_STEPS_SIZE 64
+// Input log header, "DHRP"
+#define REPLAY_MAGIC 0x50524844
+#define REPLAY_VERSION 3
+// Game settings kept in an input log
+#define REPLAY_OPTIONS 4
+// Governor: frames between temperature samples, windows a level is kept
+// before stepping down or up again, and the longest up hold after backoff
+#define GOVERNOR_WINDOW 50
+#define GOVERNOR_DOWN_HOLD 2
+#define GOVERNOR_UP_HOLD 10
+#define GOVERNOR_UP_HOLD_MAX 160
+// Telemetry sources read by the background thread
+#define TELEMETRY_ZONES 8
+#define TELEMETRY_CPUS 8
+#define TELEMETRY_INTERVAL_MS 500
+// Mixer channels shared out to voice groups, and groups kept
+#define VOICES_MAX 32
+#define VOICE_GROUPS_MAX 8
+// Audio buffer: period the automatic size starts from, the largest one,
+// and mixer callbacks watched before a size is kept
+#define AUDIO_PERIOD_MS 10
+#define AUDIO_BUFFER_MAX 4096
+#define AUDIO_PROBE_CALLBACKS 8
+// Benchmark: ticks timed per scenario, ticks run before timing starts,
+// results kept and default regression threshold in percent
+#define BENCH_ITERATIONS 1000
+#define BENCH_WARMUP 60
+#define BENCH_RESULTS_SIZE 64
+#define BENCH_TOLERANCE 10.0
+// Profiler histogram: buckets of 50us up to 50ms, plus an overflow bucket
+#define HISTOGRAM_BUCKETS 1000
+#define HISTOGRAM_BUCKET_US 50
+
+// Frame phases timed by the profiler
+enum profile_phase
+{
+  PHASE_EVENTS,
+  PHASE_UPDATE,
+  PHASE_DRAW,
+  PHASE_PRESENT,
+  PHASE_TEMP,
+  PHASE_SLEEP,
+  // Button press to the present of the first frame showing it
+  PHASE_INPUT_LATENCY,
+  PHASE_COUNT
+};
+
 struct sized_texture
 {
   SDL_Texture* texture;
@@ -27,23 +122,465 @@ struct sized_texture
   int height;
 };
 
+struct glyph
+{
+  // Glyph cell inside the atlas texture
+  SDL_Rect src;
+  // Horizontal offset of the cell from the pen position
+  int offset;
+  int advance;
+};
+
+struct glyph_atlas
+{
+  TTF_Font *font;
+  SDL_Texture *texture;
+  int width;
+  int height;
+  int line_height;
+  struct glyph glyphs[GLYPH_COUNT];
+  // Kerning between each pair of glyphs
+  short kerning[GLYPH_COUNT][GLYPH_COUNT];
+};
+
+// Textured quads submitted with a single SDL_RenderGeometry call,
+// grows instead of flushing so the number of draw calls stays constant
+struct quad_batch
+{
+  SDL_Texture *texture;
+  int texture_width;
+  int texture_height;
+  SDL_Vertex *vertices;
+  int *indices;
+  int quads;
+  int capacity;
+};
+
+// Bump allocator for data that lives as long as a round, reset in O(1)
+struct arena
+{
+  char *base;
+  size_t size;
+  // Bytes handed out, may go past size to measure what a round needs
+  size_t used;
+};
+
+// Part of the frame cached in a target texture, drawn again only when
+// the game marks it dirty or the renderer loses its targets
+struct render_layer
+{
+  SDL_Texture *texture;
+  // Position and size in the frame, at the internal resolution
+  SDL_Rect rect;
+  // Layers with holes are blended, the others copied
+  int transparent;
+  int dirty;
+  // Value of render_targets_reset when it was drawn
+  unsigned int resets;
+};
+
+// Image, or part of it, packed into the image atlas
+struct image_atlas_entry
+{
+  char path[64];
+  // Requested part of the image, zero width for all of it
+  SDL_Rect src;
+  // Where it ended up in the atlas texture
+  SDL_Rect rect;
+};
+
+struct image_atlas
+{
+  SDL_Texture *texture;
+  // Packed pixels waiting to be uploaded
+  SDL_Surface *surface;
+  int width;
+  int height;
+  int size;
+  struct image_atlas_entry entries[IMAGE_ATLAS_SIZE];
+};
+
+// Kinds of asset decoded off the render thread
+enum asset_type
+{
+  ASSET_IMAGE,
+  ASSET_SOUND,
+  ASSET_FONT,
+  ASSET_IMAGE_ATLAS
+};
+
+struct asset_job
+{
+  int type;
+  // File, or cache prefix for image atlases
+  char *path;
+  // Font point size
+  int size;
+  // SDL_Surface**, Mix_Chunk**, TTF_Font** or struct image_atlas*
+  void *target;
+  // Filled by the worker that ran it
+  int worker;
+  Uint64 start;
+  Uint64 end;
+};
+
+// Timed step of the startup, thread 0 is the render thread
+struct startup_step
+{
+  char name[48];
+  int thread;
+  Uint64 start;
+  Uint64 end;
+};
+
+enum input_type
+{
+  INPUT_BUTTON_UP,
+  INPUT_BUTTON_DOWN,
+  INPUT_AXIS
+};
+
+// Controller input handed from the input thread to the simulation
+struct input_event
+{
+  int type;
+  int controller;
+  // Button or axis
+  int index;
+  int value;
+  // Performance counter when it was read
+  Uint64 counter;
+};
+
+// State as of the last tick, all the render thread draws from. The game
+// keeps its part in game_snapshot, filled by save_snapshot
+struct game_snapshot;
+struct snapshot
+{
+  // Performance counter the last tick was due at, to interpolate from
+  Uint64 counter;
+  unsigned int frames;
+  int players;
+  int players_menu;
+  int game_over;
+  int pause;
+  // Time of the newest button press applied, for latency measurement
+  Uint64 input_counter;
+  struct game_snapshot *game;
+};
+
+// Input log: a header, then button events in the order they were
+// processed, closed by an end event followed by the state checksum
+struct replay_header
+{
+  Uint32 magic;
+  Uint32 version;
+  Uint32 seed;
+  Uint32 sim_rate;
+  Uint32 players_max;
+  // Game settings that change the simulation, see save_game_options()
+  Uint32 options[REPLAY_OPTIONS];
+};
+
+enum replay_event_type
+{
+  REPLAY_BUTTON_UP,
+  REPLAY_BUTTON_DOWN,
+  REPLAY_END
+};
+
+struct replay_event
+{
+  // Ticks run when the event was processed
+  Uint32 frame;
+  Uint8 controller;
+  Uint8 button;
+  Uint8 type;
+  // Position in the tick, see input_phase
+  Uint8 phase;
+};
+
+struct histogram
+{
+  const char *name;
+  Uint64 count;
+  Uint64 sum_us;
+  Uint32 min_us;
+  Uint32 max_us;
+  Uint32 buckets[HISTOGRAM_BUCKETS+1];
+};
+
+// Mixer channels one kind of sound plays on
+struct voice_group
+{
+  const char *name;
+  int first;
+  int count;
+  // A sound may take a voice from groups of lower or equal priority
+  int priority;
+  // Voices may be taken back from this group, oldest first
+  int stealable;
+  unsigned int played;
+  unsigned int stolen;
+  unsigned int dropped;
+};
+
+// Timings of one operation over a benchmark scenario
+struct bench_samples
+{
+  const char *name;
+  int count;
+  int capacity;
+  // Performance counter ticks of each run
+  Uint64 *ticks;
+};
+
+// Summary of one operation in one scenario, in nanoseconds
+struct bench_result
+{
+  char scenario[32];
+  char measure[32];
+  int count;
+  double p50_ns;
+  double p95_ns;
+  double p99_ns;
+  double max_ns;
+};
+
+// Latest system readings, published by the telemetry thread
+struct telemetry
+{
+  // Thermal zones in Celsius, and the hottest of them
+  int zones;
+  double zone_temperature[TELEMETRY_ZONES];
+  double temperature;
+  // Current frequency of each CPU
+  int cpus;
+  int cpu_khz[TELEMETRY_CPUS];
+  // Firmware throttling flags, -1 when the board does not report them
+  int throttled;
+  Uint32 samples;
+};
+
+// Quality step the governor can pick, cheapest last
+struct governor_level
+{
+  const char *name;
+  // Percent of the configured frame rate
+  int rate;
+  // Percent of the screen resolution rendered
+  int scale;
+  // Optional effects, e.g. filtered sprite scaling
+  int effects;
+};
+
+struct text_cache_entry
+{
+  TTF_Font *font;
+  const char *text;
+  SDL_Color color;
+  struct sized_texture texture;
+};
+
 /* Global variables */
-//Screen dimension constants
+//Screen dimension constants, the internal resolution the game draws at
 int SCREEN_WIDTH;
 int SCREEN_HEIGHT;
+// Window size, the frame is upscaled once to fit it
+int WINDOW_WIDTH;
+int WINDOW_HEIGHT;
 //The window we'll be rendering to
 SDL_Window *sdl_window;
 //The window renderer
 SDL_Renderer* sdl_renderer;
+// Offscreen mode: no window, a software renderer draws into this surface
+int offscreen;
+SDL_Surface *offscreen_surface = NULL;
+// Hash of every offscreen frame, to check renders stay pixel identical
+char *frame_hash_path = NULL;
+FILE *frame_hash_file = NULL;
+// Frame time and telemetry text, left out of hashed frames
+int show_overlay = 1;
 // Display mode
 SDL_DisplayMode sdl_display_mode;
 //Game Controllers 
-SDL_Joystick *sdl_gamepads[2];
+SDL_Joystick *sdl_gamepads[MAX_CONTROLLERS];
 // Frames count
 unsigned int frames;
+// Rendered frames count
+unsigned int render_frames;
+// Simulation ticks per second
+int sim_rate = SIM_BASE_RATE;
+// Rendered frames per second, 0 for uncapped
+int render_rate = RENDER_RATE;
+// Performance counter ticks per second
+Uint64 perf_frequency;
+// Performance counter at previous frame
+Uint64 last_counter;
+// Time not yet simulated, in performance counter ticks
+Uint64 accumulator;
+// Fraction of a tick elapsed since the last simulated state
+double render_alpha;
+// Simulation thread, or 0 to run ticks between frames on the render thread
+int sim_threaded = 1;
+SDL_Thread *sim_thread = NULL;
+// Input thread, polls controllers and stamps what changed
+int input_threaded = 1;
+int input_interval = 1;
+SDL_Thread *input_thread = NULL;
+SDL_sem *input_stop = NULL;
+// Inputs to the simulation, single producer and single consumer
+struct input_event input_queue[INPUT_QUEUE_SIZE];
+SDL_atomic_t input_head;
+SDL_atomic_t input_tail;
+// Where in the current tick the input being processed happened, in
+// 1/INPUT_PHASES. Recorded so replays place it the same way
+int input_phase;
+// Newest button press applied by the simulation
+Uint64 input_applied;
+// Press to present latency printed at exit
+int latency_report;
+Uint64 latency_last;
+// Triple buffer: the simulation writes one slot, the renderer draws
+// another, and the third is the newest complete one
+struct snapshot snapshots[3];
+int snapshot_write;
+int snapshot_read;
+SDL_atomic_t snapshot_newest;
+// Snapshot being drawn
+struct snapshot *view;
 // Render time
 unsigned int render_time;
+// Per phase frame time histograms
+struct histogram profile[PHASE_COUNT];
+// The update phase and the ticks run are written by the simulation
+// thread. The sequence is odd while it writes them
+SDL_atomic_t profile_sequence;
+unsigned int profile_ticks;
+// Profile output files prefix
+char *profile_prefix = "profile";
+// Benchmark report, the baseline it is checked against, ticks per
+// scenario, slowdown in percent that counts as a regression, and the
+// only scenario to run, NULL for all
+char *bench_path = NULL;
+char *bench_baseline_path = NULL;
+int bench_iterations = BENCH_ITERATIONS;
+double bench_tolerance = BENCH_TOLERANCE;
+char *bench_scenario = NULL;
+struct bench_result bench_results[BENCH_RESULTS_SIZE];
+int bench_results_size;
+
+// Loader jobs, queued by init and load_media
+struct asset_job asset_jobs[ASSET_JOBS_SIZE];
+int asset_jobs_size;
+SDL_atomic_t asset_next;
+SDL_atomic_t asset_done;
+// FreeType is not thread safe, fonts are opened one at a time
+SDL_mutex *font_mutex = NULL;
+// Memory mapped asset pack, NULL to load loose files
+char *pack_path = "duck_hunter.pack";
+struct asset_pack_header *pack = NULL;
+size_t pack_size;
+// Random seed, recorded so sessions can be replayed
+unsigned int seed;
+// Input log being written
+char *record_path = NULL;
+FILE *record_file = NULL;
+// Input log being replayed, joystick buttons are ignored meanwhile
+char *replay_path = NULL;
+struct replay_event *replay_events = NULL;
+int replay_size;
+int replay_next;
+unsigned int replay_checksum;
+// Replay without the frame limiter, a fixed number of ticks per frame
+int replay_fast;
+Uint64 replay_counter;
+// Startup report
+struct startup_step startup_steps[STARTUP_STEPS_SIZE];
+int startup_steps_size;
+Uint64 startup_counter;
+int startup_reported;
+// Audio device: sample rate, buffer in samples, 0 to size it from the
+// mixer callbacks, and the buffer it was opened with
+int audio_rate = ASSET_PACK_FREQUENCY;
+int audio_buffer = 0;
+int audio_buffer_opened;
+// Mixer callbacks, the last one and the longest gap between two
+SDL_atomic_t audio_callbacks;
+Uint64 audio_last_callback;
+Uint64 audio_max_gap;
+// Play to output latency: counter of a play the mixer has not picked up
+SDL_atomic_t audio_pending;
+Uint64 audio_pending_counter;
+struct histogram audio_latency;
+// Voice groups, over the first voices channels
+struct voice_group voice_groups[VOICE_GROUPS_MAX];
+int voice_groups_size;
+int voices;
+// Board temperature, in Celsius
 double temperature;
+// Telemetry: thread, its sysfs files kept open, and the snapshot it
+// publishes. The sequence is odd while the snapshot is being written
+SDL_Thread *telemetry_thread = NULL;
+SDL_sem *telemetry_stop = NULL;
+int telemetry_interval = TELEMETRY_INTERVAL_MS;
+int telemetry_zone_files[TELEMETRY_ZONES];
+int telemetry_cpu_files[TELEMETRY_CPUS];
+int telemetry_throttled_file = -1;
+struct telemetry telemetry_shared;
+SDL_atomic_t telemetry_sequence;
+// Render thread copy
+struct telemetry telemetry;
+// Thermal governor and its tunables
+struct governor_level governor_levels[] =
+{
+  {"full", 100, 100, 1},
+  {"no effects", 100, 100, 0},
+  {"75% resolution", 100, 75, 0},
+  {"50% resolution", 100, 50, 0},
+  {"80% frame rate", 80, 50, 0},
+  {"60% frame rate", 60, 50, 0}
+};
+int governor_enabled = 1;
+int governor_level;
+double governor_hot = 75.0;
+double governor_cool = 65.0;
+// Celsius per second above which a warm board counts as heating
+double governor_rising = 0.05;
+// Share of frames over budget that steps down, and that allows stepping up
+double governor_over_down = 0.10;
+double governor_over_up = 0.02;
+char *governor_log_path = NULL;
+FILE *governor_log = NULL;
+// Temperature trend, Celsius per second, smoothed
+double temperature_trend;
+double governor_last_temperature;
+Uint64 governor_last_counter;
+// Windows since the last change, and the hold before stepping up
+int governor_held;
+int governor_up_hold = GOVERNOR_UP_HOLD;
+int governor_last_up;
+// Current window frame budget statistics
+int governor_frames;
+int governor_over;
+Uint64 governor_busy;
+// What the current level asks the renderer for
+int render_scale = 100;
+int render_effects = 1;
+// Internal resolution asked for, 0 to draw at the window size
+int internal_width = 1024;
+int internal_height = 600;
+// Upscale filter, linear or nearest
+int upscale_linear = 1;
+// Offscreen target the frame is drawn into, at the internal resolution
+// scaled by the governor. Unused when that matches the window
+SDL_Texture *render_target = NULL;
+int render_target_scale;
+int render_target_bound;
+// Where the upscaled frame goes in the window, letterboxed
+SDL_Rect present_rect;
+// Times the renderer lost the contents of its targets
+unsigned int render_targets_reset;
 // SELECT Button status
 int select_button;
 // START Button status
@@ -57,6 +594,8 @@ int pause;
 
 // Players number
 int players;
+// Most players the menu offers, at least 2
+int players_max = 2;
 
 // Players menu
 int players_menu;
@@ -67,21 +606,129 @@ TTF_Font *font_medium = NULL;
 TTF_Font *font_big = NULL;
 TTF_Font *font_roboto = NULL;
 
+// Text colors
+SDL_Color color_white = {255, 255, 255, 255};
+SDL_Color color_grey = {70, 70, 70, 255};
+SDL_Color color_black = {0, 0, 0, 255};
+
+// Glyph atlases, one per font
+struct glyph_atlas atlas_small;
+struct glyph_atlas atlas_medium;
+struct glyph_atlas atlas_big;
+struct glyph_atlas atlas_roboto;
+// Batch used to submit text quads
+struct quad_batch text_batch;
+// Cached static strings
+struct text_cache_entry text_cache[TEXT_CACHE_SIZE];
+int text_cache_size;
+
 
 /* Method already implemented */
 void init();
 void close_sdl();
 void load_texture(struct sized_texture *texture, char *path);
 TTF_Font* load_font(char *font_path, int size);
+void upload_texture(struct sized_texture *texture, SDL_Surface *surface, char *path);
+void open_pack(char *path);
+void close_pack();
+struct asset_pack_entry* pack_find(char *name, int type);
+SDL_Surface* load_image(char *path);
+Mix_Chunk* load_sound(char *path);
+void asset_queue(int type, char *path, int size, void *target);
+void asset_run(struct asset_job *job);
+int asset_worker(void *data);
+void load_assets();
+void render_loading(int done, int total);
+void startup_add(const char *name, int thread, Uint64 start, Uint64 end);
+void startup_report();
 void loadTFTTexture(struct sized_texture *texture, TTF_Font *font, char* text, SDL_Color color);
+void init_text();
+void close_text();
+void load_glyph_atlas(struct glyph_atlas *atlas, TTF_Font *font);
+int image_atlas_add(struct image_atlas *atlas, char *path, int x, int y, int w, int h);
+void image_atlas_pack(struct image_atlas *atlas, char *cache_prefix);
+void image_atlas_upload(struct image_atlas *atlas);
+int image_atlas_load_cache(struct image_atlas *atlas, char *cache_prefix);
+void image_atlas_save_cache(struct image_atlas *atlas, SDL_Surface *surface, char *cache_prefix);
+void image_atlas_free(struct image_atlas *atlas);
+void batch_init(struct quad_batch *batch, int capacity);
+void batch_free(struct quad_batch *batch);
+void batch_add_quad(struct quad_batch *batch, SDL_Texture *texture, SDL_Rect *src, SDL_Rect *dst, SDL_Color color, SDL_RendererFlip flip);
+void batch_flush(struct quad_batch *batch);
+int text_width(struct glyph_atlas *atlas, const char *text);
+void draw_text(struct glyph_atlas *atlas, const char *text, int x, int y, SDL_Color color);
+struct sized_texture* get_static_text(TTF_Font *font, const char *text, SDL_Color color);
 void sync_render();
+void sim_step();
+int sim_worker(void *data);
+void init_sim();
+void close_sim();
+void init_input();
+void close_input();
+int input_worker(void *data);
+void input_push(int type, int controller, int index, int value, Uint64 counter);
+void input_drain(Uint64 tick_start, Uint64 tick_end);
+void latency_print();
+void snapshot_publish();
+void snapshot_acquire();
+void begin_frame();
+void end_frame();
+int layer_begin(struct render_layer *layer, int x, int y, int w, int h, int transparent);
+void layer_end(struct render_layer *layer);
+void layer_draw(struct render_layer *layer);
+void layer_free(struct render_layer *layer);
 void process_input(SDL_Event *e);
+void process_button(int controller, int button, int down);
+void record_open(char *path);
+void record_event(int controller, int button, int type);
+void record_close();
+void replay_load(char *path);
+void replay_input();
+int replay_report();
 void render_menu();
+void arena_init(struct arena *arena, size_t size);
+void* arena_alloc(struct arena *arena, size_t size);
+void arena_reset(struct arena *arena);
+void arena_free(struct arena *arena);
 void read_temp();
+void init_telemetry();
+void close_telemetry();
+int telemetry_worker(void *data);
+long telemetry_read_file(int fd, int base);
+void telemetry_publish(struct telemetry *sample);
+void telemetry_snapshot(struct telemetry *sample);
+void governor_frame(Uint64 busy, Uint64 frame_period);
+void governor_update();
+void governor_set_level(int level, const char *reason, double over);
+int frame_rate();
+void parse_args(int argc, char* args[]);
+void init_timing();
+unsigned int sim_ticks(unsigned int base_ticks);
+int interpolate(int previous, int current);
+void play_sound(Mix_Chunk *chunk, int group);
+void open_audio();
+void audio_postmix(void *data, Uint8 *stream, int length);
+int voice_group_add(const char *name, int count, int priority, int stealable);
+int voice_steal(int priority);
+void audio_report();
+void init_profile();
+void profile_add(int phase, Uint64 start, Uint64 end);
+void histogram_add(struct histogram *histogram, Uint32 us);
+Uint32 histogram_percentile(struct histogram *histogram, double percentile);
+void histogram_write_json(FILE *file, struct histogram *histogram);
+void profile_dump();
+void bench_add(struct bench_samples *samples, Uint64 start, Uint64 end);
+void bench_record(const char *scenario, struct bench_samples *samples);
+int bench_compare_ticks(const void *a, const void *b);
+void bench_write(char *path);
+int bench_check(char *path);
+Uint64 frame_hash();
+void frame_hash_write(const char *scenario, int frame);
 
 
 /******* Methods to implement *******/
 void load_media();
+void upload_media();
 void close_media();
 void init_game();
 void update_game();
@@ -89,14 +736,25 @@ void render();
 void process_axis(int controller, int axis, int value);
 void process_button_down(int controller, int button);
 void process_button_up(int controller, int button);
+int process_arg(int argc, char* args[], int i);
+void print_game_options();
+unsigned int state_checksum();
+void save_game_options(Uint32 *options);
+void load_game_options(const Uint32 *options);
+void save_snapshot(struct snapshot *snapshot);
+void free_snapshot(struct snapshot *snapshot);
+void run_bench();
 
 /* Methods implementation */
+#ifndef HEADLESS
 void init()
 {
+  Uint64 start;
   int i;
   SCREEN_WIDTH = 1024;
   SCREEN_HEIGHT = 600;
   frames = 0;
+  render_frames = 0;
   render_time=0;
   temperature=0;
   game_over=0;
@@ -108,15 +766,22 @@ void init()
   start_button=0;
   sdl_window=NULL;
   sdl_renderer = NULL;
-  sdl_gamepads[0] = NULL;
-  sdl_gamepads[1] = NULL;
+  for(i=0; i<MAX_CONTROLLERS; i++)
+  {
+    sdl_gamepads[i] = NULL;
+  }
   
-  //Initialize SDL
-  if( SDL_Init( SDL_INIT_VIDEO | SDL_INIT_JOYSTICK ) < 0 )
+  //Initialize SDL, offscreen needs no display nor controllers
+  start = SDL_GetPerformanceCounter();
+  if( SDL_Init( offscreen ? 0 : SDL_INIT_VIDEO | SDL_INIT_JOYSTICK ) < 0 )
   {
     printf( "SDL could not initialize! SDL Error: %s\n", SDL_GetError() );
     exit(-1);
   }
+  startup_add("SDL_Init", 0, start, SDL_GetPerformanceCounter());
+  
+  // Sample temperatures and clocks in the background
+  init_telemetry();
   
   //Set texture filtering to linear
   if( !SDL_SetHint( SDL_HINT_RENDER_SCALE_QUALITY, "1" ) )
@@ -126,6 +791,7 @@ void init()
   }
   
   //Check for joysticks 
+  start = SDL_GetPerformanceCounter();
   if( SDL_NumJoysticks() < 1 ) 
   { 
     printf( "Warning: No joysticks connected!\n" ); 
@@ -133,7 +799,7 @@ void init()
   else 
   {
     printf("%d joysticks connected\n", SDL_NumJoysticks());
-    for(i=0; i<SDL_NumJoysticks(); i++)
+    for(i=0; i<SDL_NumJoysticks() && i<MAX_CONTROLLERS; i++)
     {
       //Load joystick 
       sdl_gamepads[i] = SDL_JoystickOpen(i); 
@@ -145,19 +811,27 @@ void init()
     }
     
   }
+  startup_add("joysticks", 0, start, SDL_GetPerformanceCounter());
   
-  if(FULL_SCREEN)
+  start = SDL_GetPerformanceCounter();
+  if(offscreen)
+  {
+    // Surface at the internal resolution, nothing to upscale
+    WINDOW_WIDTH=internal_width > 0 ? internal_width : SCREEN_WIDTH;
+    WINDOW_HEIGHT=internal_height > 0 ? internal_height : SCREEN_HEIGHT;
+  }
+  else if(FULL_SCREEN && bench_path == NULL)
   {
     // Get display mode
     if (SDL_GetDesktopDisplayMode(0, &sdl_display_mode) != 0) {
       printf("SDL_GetDesktopDisplayMode failed: %s", SDL_GetError());
       exit(-1);
     }
-    SCREEN_WIDTH=sdl_display_mode.w;
-    SCREEN_HEIGHT=sdl_display_mode.h;
+    WINDOW_WIDTH=sdl_display_mode.w;
+    WINDOW_HEIGHT=sdl_display_mode.h;
     
     //Create window
-    sdl_window = SDL_CreateWindow("Duck_hunter", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_FULLSCREEN);
+    sdl_window = SDL_CreateWindow("Duck_hunter", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_FULLSCREEN);
     if( sdl_window == NULL )
     {
       printf( "Window could not be created! SDL Error: %s\n", SDL_GetError() );
@@ -166,18 +840,63 @@ void init()
   }
   else
   {
-    sdl_window = SDL_CreateWindow("Duck_hunter", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+    WINDOW_WIDTH=SCREEN_WIDTH;
+    WINDOW_HEIGHT=SCREEN_HEIGHT;
+    // Benchmarks draw into a window that is never shown
+    sdl_window = SDL_CreateWindow("Duck_hunter", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT,
+				  bench_path != NULL ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN);
+  }
+  
+  // Game coordinates are in the internal resolution, whatever the panel
+  if(internal_width > 0)
+  {
+    SCREEN_WIDTH=internal_width;
+    SCREEN_HEIGHT=internal_height;
+  }
+  else
+  {
+    SCREEN_WIDTH=WINDOW_WIDTH;
+    SCREEN_HEIGHT=WINDOW_HEIGHT;
   }
   
-  //Create renderer for window
-  sdl_renderer = SDL_CreateRenderer( sdl_window, -1, SDL_RENDERER_ACCELERATED );
+  // Largest rectangle with the internal aspect ratio, centered
+  if(WINDOW_WIDTH*SCREEN_HEIGHT <= WINDOW_HEIGHT*SCREEN_WIDTH)
+  {
+    present_rect.w=WINDOW_WIDTH;
+    present_rect.h=SCREEN_HEIGHT*WINDOW_WIDTH/SCREEN_WIDTH;
+  }
+  else
+  {
+    present_rect.w=SCREEN_WIDTH*WINDOW_HEIGHT/SCREEN_HEIGHT;
+    present_rect.h=WINDOW_HEIGHT;
+  }
+  present_rect.x=(WINDOW_WIDTH-present_rect.w)/2;
+  present_rect.y=(WINDOW_HEIGHT-present_rect.h)/2;
+  
+  //Create renderer for window, or for the offscreen surface
+  if(offscreen)
+  {
+    offscreen_surface = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_ARGB8888);
+    if( offscreen_surface == NULL )
+    {
+      printf( "Offscreen surface could not be created! SDL Error: %s\n", SDL_GetError() );
+      exit(-1);
+    }
+    sdl_renderer = SDL_CreateSoftwareRenderer( offscreen_surface );
+  }
+  else
+  {
+    sdl_renderer = SDL_CreateRenderer( sdl_window, -1, SDL_RENDERER_ACCELERATED );
+  }
   if( sdl_renderer == NULL )
   {
     printf( "Renderer could not be created! SDL Error: %s\n", SDL_GetError() );
     exit(-1);
   }
+  startup_add("window and renderer", 0, start, SDL_GetPerformanceCounter());
   
   //Initialize SDL_ttf 
+  start = SDL_GetPerformanceCounter();
   if(TTF_Init()<0) 
   {
     printf( "SDL_ttf could not initialize! SDL_ttf Error: %s\n", TTF_GetError() ); 
@@ -191,28 +910,28 @@ void init()
     exit(-1);
   }
   
+  startup_add("TTF and IMG init", 0, start, SDL_GetPerformanceCounter());
+  
   //Initialize SDL_mixer 
-  if(Mix_OpenAudio( 22050, MIX_DEFAULT_FORMAT, 2, 512 )<0) 
-  { 
-    printf( "SDL_mixer could not initialize!\n");
-    exit(-1);
-  }
+  start = SDL_GetPerformanceCounter();
+  open_audio();
+  startup_add("Mix_OpenAudio", 0, start, SDL_GetPerformanceCounter());
   
   //Initialize renderer color
   SDL_SetRenderDrawColor( sdl_renderer, 0xFF, 0xFF, 0xFF, 0xFF );
   
-  // Load small font
-  font_small = load_font("ArcadeClassic.ttf", 50);
-  
-  // Load medium font
-  font_medium = load_font("ArcadeClassic.ttf", 80);
-  
-  // Load big font
-  font_big = load_font("ArcadeClassic.ttf", 100);  
-  
-  // Load font font roboto
-  font_roboto = load_font("Roboto-Light.ttf", 14); 
+  // Map the asset pack, missing assets fall back to loose files
+  start = SDL_GetPerformanceCounter();
+  open_pack(pack_path);
+  startup_add("map asset pack", 0, start, SDL_GetPerformanceCounter());
   
+  // Fonts are opened by the loader workers, with the game media
+  asset_jobs_size=0;
+  font_mutex=SDL_CreateMutex();
+  asset_queue(ASSET_FONT, "ArcadeClassic.ttf", 50, &font_small);
+  asset_queue(ASSET_FONT, "ArcadeClassic.ttf", 80, &font_medium);
+  asset_queue(ASSET_FONT, "ArcadeClassic.ttf", 100, &font_big);
+  asset_queue(ASSET_FONT, "Roboto-Light.ttf", 14, &font_roboto);
 }
 
 void close_sdl()
@@ -221,6 +940,9 @@ void close_sdl()
   
   // Close media
   close_media();
+  
+  // Free glyph atlases and cached text
+  close_text();
 
   // Close small font
   TTF_CloseFont(font_small);
@@ -231,6 +953,13 @@ void close_sdl()
   // Close font roboto
   TTF_CloseFont(font_roboto);
   
+  // Internal resolution target
+  if(render_target != NULL)
+  {
+    SDL_DestroyTexture(render_target);
+    render_target=NULL;
+  }
+  
   //Destroy renderer  
   if(sdl_renderer!=NULL)
   {
@@ -245,15 +974,34 @@ void close_sdl()
     sdl_window=NULL;
   }
   
+  // Offscreen surface, once its renderer is gone
+  if(offscreen_surface != NULL)
+  {
+    SDL_FreeSurface( offscreen_surface );
+    offscreen_surface=NULL;
+  }
+  
   // Close gamepads
-  for(i=0; i<SDL_NumJoysticks(); i++)
+  for(i=0; i<MAX_CONTROLLERS; i++)
   {
-    SDL_JoystickClose(sdl_gamepads[i]);
-    sdl_gamepads[i]=NULL;
+    if(sdl_gamepads[i] != NULL)
+    {
+      SDL_JoystickClose(sdl_gamepads[i]);
+      sdl_gamepads[i]=NULL;
+    }
   }
   
+  // Stop sampling
+  close_telemetry();
+  
   // Exit SDL
   Mix_CloseAudio();
+  if(latency_report)
+  {
+    audio_report();
+  }
+  // Sounds play straight from the pack, unmap it after the mixer is closed
+  close_pack();
   TTF_Quit();
   IMG_Quit();
   SDL_Quit();
@@ -265,885 +1013,5789 @@ void load_texture(struct sized_texture *texture, char *path)
   SDL_Surface* loadedSurface;
   
   //Load image at specified path
-  loadedSurface = IMG_Load(path);
-  if(loadedSurface == NULL )
-  {
-    printf( "Unable to load image %s! SDL_image Error: %s\n", path, IMG_GetError() );
-    exit(-1);
-  }
+  loadedSurface = load_image(path);
+  upload_texture(texture, loadedSurface, path);
+}
+
+void upload_texture(struct sized_texture *texture, SDL_Surface *surface, char *path)
+{
   //Get image dimensions 
-  texture->width = loadedSurface->w; 
-  texture->height = loadedSurface->h;
+  texture->width = surface->w; 
+  texture->height = surface->h;
   //Create texture from surface pixels
-  texture->texture = SDL_CreateTextureFromSurface(sdl_renderer, loadedSurface);
+  texture->texture = SDL_CreateTextureFromSurface(sdl_renderer, surface);
   if( texture->texture == NULL )
   {
     printf( "Unable to create texture from %s! SDL Error: %s\n", path, SDL_GetError() );
   }
   
   //Get rid of old loaded surface
-  SDL_FreeSurface(loadedSurface);
-  
+  SDL_FreeSurface(surface);
 }
 
-TTF_Font* load_font(char *font_path, int size)
+int image_atlas_add(struct image_atlas *atlas, char *path, int x, int y, int w, int h)
 {
-  TTF_Font *font;
+  struct image_atlas_entry *entry;
   
-  //Open the font 
-  font = TTF_OpenFont(font_path, size); 
-  if( font == NULL ) 
-  { 
-    printf( "Failed to load lazy font! SDL_ttf Error: %s\n", TTF_GetError());
+  if(atlas->size == IMAGE_ATLAS_SIZE)
+  {
+    printf("Image atlas full, unable to add %s\n", path);
     exit(-1);
   }
+  entry=&atlas->entries[atlas->size];
+  snprintf(entry->path, sizeof(entry->path), "%s", path);
+  entry->src.x=x;
+  entry->src.y=y;
+  entry->src.w=w;
+  entry->src.h=h;
   
-  return font;
+  // Index used to look the entry up when drawing
+  return atlas->size++;
 }
 
-void loadTFTTexture(struct sized_texture *texture, TTF_Font *font, char* text, SDL_Color color)
+void image_atlas_pack(struct image_atlas *atlas, char *cache_prefix)
 {
-  //The final texture
-  texture->texture = NULL;
-    
-  //Load image at specified path
-  SDL_Surface *loadedSurface = TTF_RenderText_Solid( font, text, color );
-  if( loadedSurface == NULL )
+  SDL_Surface *images[IMAGE_ATLAS_SIZE];
+  SDL_Surface *loaded_surface;
+  SDL_Surface *atlas_surface;
+  struct image_atlas_entry *entry;
+  int order[IMAGE_ATLAS_SIZE];
+  int i, j, tmp, x, y, row_height;
+  
+  // Previous start already packed these images
+  if(cache_prefix != NULL && image_atlas_load_cache(atlas, cache_prefix))
   {
-    printf( "Unable to render text! SDL_image Error: %s\n", TTF_GetError() );
-    exit(-1);
+    return;
   }
-  else
+  
+  // Load every image once, as RGBA so colour keys become alpha
+  for(i=0; i<atlas->size; i++)
   {
-    //printf("Surface: %d, %d\n", loadedSurface->w, loadedSurface->h);
-    
-    //Create texture from surface pixels
-    texture->texture = SDL_CreateTextureFromSurface(sdl_renderer, loadedSurface );
-    if( texture->texture == NULL )
+    images[i]=NULL;
+    for(j=0; j<i; j++)
     {
-      printf( "Unable to create texture! SDL Error: %s\n", SDL_GetError() );
-      exit(-1);
+      if(strcmp(atlas->entries[i].path, atlas->entries[j].path)==0)
+      {
+	images[i]=images[j];
+	break;
+      }
     }
-    else {
-      //Get image dimensions 
-      texture->width = loadedSurface->w; 
-      texture->height = loadedSurface->h;      
+    if(images[i] == NULL)
+    {
+      loaded_surface=load_image(atlas->entries[i].path);
+      images[i]=SDL_ConvertSurfaceFormat(loaded_surface, SDL_PIXELFORMAT_RGBA32, 0);
+      SDL_FreeSurface(loaded_surface);
+      if(images[i] == NULL)
+      {
+	printf( "Unable to convert image %s! SDL Error: %s\n", atlas->entries[i].path, SDL_GetError() );
+	exit(-1);
+      }
+      SDL_SetSurfaceBlendMode(images[i], SDL_BLENDMODE_NONE);
     }
-    
-    //Get rid of old loaded surface
-    SDL_FreeSurface( loadedSurface );
+    entry=&atlas->entries[i];
+    if(entry->src.w == 0)
+    {
+      entry->src.x=0;
+      entry->src.y=0;
+      entry->src.w=images[i]->w;
+      entry->src.h=images[i]->h;
+    }
+    entry->rect.w=entry->src.w;
+    entry->rect.h=entry->src.h;
+    order[i]=i;
   }
   
-}
-
-void sync_render()
-{
-  unsigned int start, end; 
+  // Tallest first packs the shelves tighter
+  for(i=1; i<atlas->size; i++)
+  {
+    for(j=i; j>0 && atlas->entries[order[j]].rect.h > atlas->entries[order[j-1]].rect.h; j--)
+    {
+      tmp=order[j];
+      order[j]=order[j-1];
+      order[j-1]=tmp;
+    }
+  }
   
-  start = SDL_GetTicks();
-  if(!game_over && !pause && !players_menu)
+  // Lay images out in shelves
+  x=0;
+  y=0;
+  row_height=0;
+  for(i=0; i<atlas->size; i++)
   {
-    // Count frames
-    frames++;
-    // Update game data
-    update_game();
+    entry=&atlas->entries[order[i]];
+    if(entry->rect.w > IMAGE_ATLAS_WIDTH)
+    {
+      printf("Image %s wider than the image atlas\n", entry->path);
+      exit(-1);
+    }
+    if(x+entry->rect.w > IMAGE_ATLAS_WIDTH)
+    {
+      x=0;
+      y+=row_height+IMAGE_ATLAS_PADDING;
+      row_height=0;
+    }
+    entry->rect.x=x;
+    entry->rect.y=y;
+    x+=entry->rect.w+IMAGE_ATLAS_PADDING;
+    if(entry->rect.h>row_height) row_height=entry->rect.h;
   }
-  // Render screen
-  if(players_menu)
+  atlas->width=IMAGE_ATLAS_WIDTH;
+  atlas->height=y+row_height;
+  
+  // Copy images, unused space stays transparent
+  atlas_surface=SDL_CreateRGBSurfaceWithFormat(0, atlas->width, atlas->height, 32, SDL_PIXELFORMAT_RGBA32);
+  if(atlas_surface == NULL)
   {
-    render_menu();
+    printf("Unable to create image atlas! SDL Error: %s\n", SDL_GetError());
+    exit(-1);
   }
-  else
+  for(i=0; i<atlas->size; i++)
   {
-    render();  
+    SDL_BlitSurface(images[i], &atlas->entries[i].src, atlas_surface, &atlas->entries[i].rect);
   }
-  
-  if(frames%50==0)
+  for(i=0; i<atlas->size; i++)
   {
-    read_temp();
+    for(j=i+1; j<atlas->size; j++)
+    {
+      if(images[j]==images[i]) images[j]=NULL;
+    }
+    SDL_FreeSurface(images[i]);
   }
   
-  end = SDL_GetTicks();
-  render_time = end - start;
-  
-  // 60 fps -> 16ms
-  // 30 fps -> 32ms
-  // 50 fps -> 20ms
-  // 100 fps -> 10ms
-  
-  if(render_time < 20)
+  if(cache_prefix != NULL)
   {
-    //remaining = 1;
-    SDL_Delay(20 - render_time);
+    image_atlas_save_cache(atlas, atlas_surface, cache_prefix);
   }
-  else
-  {
-    printf("Render time: %ud !!!!\n", render_time);
-  }  
+  atlas->surface=atlas_surface;
 }
 
-void process_input(SDL_Event *e)
+void image_atlas_upload(struct image_atlas *atlas)
 {
-  //User requests quit
-  if(e->type == SDL_QUIT 
-    // User press ESC or q
-    || (e->type == SDL_KEYDOWN && (e->key.keysym.sym=='q' || e->key.keysym.sym == 27))
-  )
+  // Only part that needs the renderer
+  atlas->texture=SDL_CreateTextureFromSurface(sdl_renderer, atlas->surface);
+  if(atlas->texture == NULL)
   {
-    quit = 1;
+    printf("Unable to create image atlas texture! SDL Error: %s\n", SDL_GetError());
+    exit(-1);
   }
-  // Axis 0 controls player velocity
-  else if(e->type == SDL_JOYAXISMOTION)
+  SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+  SDL_FreeSurface(atlas->surface);
+  atlas->surface=NULL;
+}
+
+int image_atlas_load_cache(struct image_atlas *atlas, char *cache_prefix)
+{
+  struct image_atlas_entry *entry;
+  struct stat cache_stat, image_stat;
+  SDL_Rect src;
+  FILE *file;
+  char path[128], entry_path[64];
+  int i, size, valid;
+  
+  // Cache is stale if any image changed after it was written
+  snprintf(path, sizeof(path), "%s.bmp", cache_prefix);
+  if(stat(path, &cache_stat) != 0) return 0;
+  for(i=0; i<atlas->size; i++)
   {
-    //printf("controller: %d, axis: %d, value: %d\n", e->jaxis.which, e->jaxis.axis, e->jaxis.value);
-    process_axis(e->jaxis.which, e->jaxis.axis, e->jaxis.value);
+    if(stat(atlas->entries[i].path, &image_stat) != 0 || image_stat.st_mtime > cache_stat.st_mtime) return 0;
   }
-  // Buttons down
-  else if(e->type == SDL_JOYBUTTONDOWN) 
+  
+  // Lookup table, must describe the same entries
+  snprintf(path, sizeof(path), "%s.txt", cache_prefix);
+  file=fopen(path, "r");
+  if(file == NULL) return 0;
+  valid = fscanf(file, "%d %d %d", &atlas->width, &atlas->height, &size)==3 && size==atlas->size;
+  for(i=0; valid && i<atlas->size; i++)
   {
-    if(e->jbutton.button == BUTTON_SELECT)
-    {
-      select_button=1;
-    }
-    if(e->jbutton.button == BUTTON_START)
-    {
-      start_button=1;
-    }
-    if(e->jbutton.button != BUTTON_SELECT && e->jbutton.button != BUTTON_START)
-    {
-      process_button_down(e->jbutton.which, e->jbutton.button);
-    }
+    entry=&atlas->entries[i];
+    valid = fscanf(file, "%63s %d %d %d %d %d %d %d %d", entry_path, &src.x, &src.y, &src.w, &src.h,
+		   &entry->rect.x, &entry->rect.y, &entry->rect.w, &entry->rect.h)==9
+      && strcmp(entry_path, entry->path)==0
+      && (entry->src.w==0 || (src.x==entry->src.x && src.y==entry->src.y && src.w==entry->src.w && src.h==entry->src.h));
+    if(valid) entry->src=src;
   }
-  // Buttons up
-  else if(e->type == SDL_JOYBUTTONUP) 
+  fclose(file);
+  if(!valid) return 0;
+  
+  snprintf(path, sizeof(path), "%s.bmp", cache_prefix);
+  atlas->surface=SDL_LoadBMP(path);
+  return atlas->surface != NULL;
+}
+
+void image_atlas_save_cache(struct image_atlas *atlas, SDL_Surface *surface, char *cache_prefix)
+{
+  struct image_atlas_entry *entry;
+  FILE *file;
+  char path[128];
+  int i;
+  
+  // A failed save only costs packing again next start
+  snprintf(path, sizeof(path), "%s.bmp", cache_prefix);
+  if(SDL_SaveBMP(surface, path) != 0)
   {
-    if(e->jbutton.button == BUTTON_SELECT)
-    {
-      select_button=0;
-    }
-    if(e->jbutton.button == BUTTON_START)
-    {
-      start_button=0;
-    }
-    if(e->jbutton.button != BUTTON_SELECT && e->jbutton.button != BUTTON_START)
-    {
-      process_button_up(e->jbutton.which, e->jbutton.button);
-    }
+    printf("Unable to save image atlas cache %s! SDL Error: %s\n", path, SDL_GetError());
+    return;
   }
-  if(start_button && select_button)
+  snprintf(path, sizeof(path), "%s.txt", cache_prefix);
+  file=fopen(path, "w");
+  if(file == NULL)
   {
-    quit=1;
+    printf("Unable to save image atlas cache %s\n", path);
+    return;
   }
-  if(players_menu && select_button)
+  fprintf(file, "%d %d %d\n", atlas->width, atlas->height, atlas->size);
+  for(i=0; i<atlas->size; i++)
   {
-    players++;
-    if(players>2)
-    {
-      players=1;
-    }
+    entry=&atlas->entries[i];
+    fprintf(file, "%s %d %d %d %d %d %d %d %d\n", entry->path, entry->src.x, entry->src.y, entry->src.w, entry->src.h,
+	    entry->rect.x, entry->rect.y, entry->rect.w, entry->rect.h);
   }
-  if(players_menu && start_button)
+  fclose(file);
+}
+
+void image_atlas_free(struct image_atlas *atlas)
+{
+  SDL_DestroyTexture(atlas->texture);
+  memset(atlas, 0, sizeof(struct image_atlas));
+}
+
+TTF_Font* load_font(char *font_path, int size)
+{
+  struct asset_pack_entry *entry;
+  TTF_Font *font;
+  
+  //Open the font, FreeType reads it in place from the pack
+  entry = pack_find(font_path, ASSET_PACK_FILE);
+  if(entry != NULL)
   {
-    // Init game data
-    init_game();
-    // Close menu
-    players_menu=0;
+    font = TTF_OpenFontRW(SDL_RWFromConstMem((char*)pack + entry->offset, entry->size), 1, size);
   }
-  if(game_over && start_button)
+  else
   {
-    game_over=0;
-    players_menu=1;
+    font = TTF_OpenFont(font_path, size); 
+  }
+  if( font == NULL ) 
+  { 
+    printf( "Failed to load lazy font! SDL_ttf Error: %s\n", TTF_GetError());
+    exit(-1);
   }
+  
+  return font;
 }
 
-void render_menu()
+void open_pack(char *path)
 {
-  SDL_Rect sdl_rect;
-  struct sized_texture texture_text;
-  SDL_Color sdl_color;
+  struct asset_pack_entry *entries;
+  struct stat pack_stat, file_stat;
+  FILE *file;
+  void *data;
+  Uint32 i;
   
-  //Clear screen
-  SDL_SetRenderDrawColor( sdl_renderer, 0x00, 0x00, 0x00, 0xFF );
-  SDL_RenderClear( sdl_renderer );
+  pack=NULL;
+  if(path == NULL) return;
+  file=fopen(path, "rb");
+  if(file == NULL) return;
+  if(fstat(fileno(file), &pack_stat) != 0 || pack_stat.st_size < (off_t)sizeof(struct asset_pack_header))
+  {
+    fclose(file);
+    printf("Warning: asset pack %s is not valid, using loose files\n", path);
+    return;
+  }
+  
+  // Read only pages, shared with the page cache
+  data=mmap(NULL, pack_stat.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  fclose(file);
+  if(data == MAP_FAILED)
+  {
+    printf("Warning: unable to map asset pack %s, using loose files\n", path);
+    return;
+  }
+  pack=data;
+  pack_size=pack_stat.st_size;
+  
+  // Header and every entry must lie inside the file
+  entries=(struct asset_pack_entry*)(pack+1);
+  if(pack->magic != ASSET_PACK_MAGIC || pack->version != ASSET_PACK_VERSION
+     || sizeof(struct asset_pack_header) + (size_t)pack->count*sizeof(struct asset_pack_entry) > pack_size)
+  {
+    printf("Warning: asset pack %s is not valid, using loose files\n", path);
+    close_pack();
+    return;
+  }
+  for(i=0; i<pack->count; i++)
+  {
+    if((size_t)entries[i].offset + entries[i].size > pack_size)
+    {
+      printf("Warning: asset pack %s is truncated, using loose files\n", path);
+      close_pack();
+      return;
+    }
+    // A loose file edited since the pack was built wins
+    if(stat(entries[i].name, &file_stat) == 0 && file_stat.st_mtime > pack_stat.st_mtime)
+    {
+      printf("Warning: %s is newer than asset pack %s, using loose files\n", entries[i].name, path);
+      close_pack();
+      return;
+    }
+  }
+}
+
+void close_pack()
+{
+  if(pack != NULL)
+  {
+    munmap(pack, pack_size);
+    pack=NULL;
+  }
+}
+
+struct asset_pack_entry* pack_find(char *name, int type)
+{
+  struct asset_pack_entry *entries;
+  Uint32 i;
+  
+  if(pack == NULL) return NULL;
+  entries=(struct asset_pack_entry*)(pack+1);
+  for(i=0; i<pack->count; i++)
+  {
+    if(entries[i].type == (Uint32)type && strncmp(entries[i].name, name, ASSET_PACK_NAME_SIZE)==0)
+    {
+      return &entries[i];
+    }
+  }
+  return NULL;
+}
+
+SDL_Surface* load_image(char *path)
+{
+  struct asset_pack_entry *entry;
+  SDL_Surface *surface;
   
-  if(players==1)
+  // Decoded pixels used in place, the surface must never be written
+  entry=pack_find(path, ASSET_PACK_IMAGE);
+  if(entry != NULL)
   {
-    sdl_color.r=255;
-    sdl_color.g=255;
-    sdl_color.b=255;
-    sdl_color.a=255;
+    surface=SDL_CreateRGBSurfaceWithFormatFrom((char*)pack + entry->offset, entry->params[0], entry->params[1],
+					       32, entry->params[2], entry->params[3]);
   }
   else
   {
-    sdl_color.r=70;
-    sdl_color.g=70;
-    sdl_color.b=70;
-    sdl_color.a=255;
+    surface=IMG_Load(path);
+  }
+  if(surface == NULL)
+  {
+    printf( "Unable to load image %s! SDL_image Error: %s\n", path, IMG_GetError() );
+    exit(-1);
   }
-  loadTFTTexture(&texture_text, font_medium, "1 Player", sdl_color);
-  sdl_rect.x=SCREEN_WIDTH/2-texture_text.width/2;
-  sdl_rect.y=SCREEN_HEIGHT-100-texture_text.height-texture_text.height;
-  sdl_rect.y/=2;
-  sdl_rect.w=texture_text.width;
-  sdl_rect.h=texture_text.height;  
-  SDL_RenderCopy(sdl_renderer, texture_text.texture, NULL, &sdl_rect);
-  SDL_DestroyTexture(texture_text.texture);
+  return surface;
+}
+
+Mix_Chunk* load_sound(char *path)
+{
+  struct asset_pack_entry *entry;
+  Mix_Chunk *chunk;
+  Uint16 format;
+  int frequency, channels;
   
-  if(players==2)
+  // Samples already in the mixer format play straight from the pack
+  entry=pack_find(path, ASSET_PACK_SOUND);
+  Mix_QuerySpec(&frequency, &format, &channels);
+  if(entry != NULL && entry->params[0] == (Uint32)frequency && entry->params[1] == format && entry->params[2] == (Uint32)channels)
   {
-    sdl_color.r=255;
-    sdl_color.g=255;
-    sdl_color.b=255;
-    sdl_color.a=255;
+    chunk=Mix_QuickLoad_RAW((Uint8*)pack + entry->offset, entry->size);
   }
   else
   {
-    sdl_color.r=70;
-    sdl_color.g=70;
-    sdl_color.b=70;
-    sdl_color.a=255;
+    chunk=Mix_LoadWAV(path);
+  }
+  if(chunk == NULL)
+  {
+    printf( "Unable to load sound %s! SDL_mixer Error: %s\n", path, Mix_GetError() );
+    exit(-1);
   }
-  sdl_rect.y+=100;
-  loadTFTTexture(&texture_text, font_medium, "2 Players", sdl_color);
-  sdl_rect.w=texture_text.width;
-  sdl_rect.h=texture_text.height;  
-  SDL_RenderCopy(sdl_renderer, texture_text.texture, NULL, &sdl_rect);
-  SDL_DestroyTexture(texture_text.texture);
+  return chunk;
+}
+
+void asset_queue(int type, char *path, int size, void *target)
+{
+  struct asset_job *job;
   
-  //Update screen
-  SDL_RenderPresent(sdl_renderer);
+  if(asset_jobs_size == ASSET_JOBS_SIZE)
+  {
+    printf("Asset queue full, unable to load %s\n", path);
+    exit(-1);
+  }
+  job=&asset_jobs[asset_jobs_size++];
+  job->type=type;
+  job->path=path;
+  job->size=size;
+  job->target=target;
 }
 
-void read_temp()
+void asset_run(struct asset_job *job)
 {
-  FILE *temperatureFile;
-  temperatureFile = fopen ("/sys/class/thermal/thermal_zone0/temp", "r");
-  if (temperatureFile != NULL)
+  // Decode only, nothing here may touch the renderer
+  switch(job->type)
   {
-    fscanf (temperatureFile, "%lf", &temperature);
-    temperature /= 1000;
-    fclose (temperatureFile);
+    case ASSET_IMAGE:
+      *(SDL_Surface**)job->target=load_image(job->path);
+      break;
+    case ASSET_SOUND:
+      *(Mix_Chunk**)job->target=load_sound(job->path);
+      break;
+    case ASSET_FONT:
+      SDL_LockMutex(font_mutex);
+      *(TTF_Font**)job->target=load_font(job->path, job->size);
+      SDL_UnlockMutex(font_mutex);
+      break;
+    case ASSET_IMAGE_ATLAS:
+      image_atlas_pack((struct image_atlas*)job->target, job->path);
+      break;
   }
 }
 
-int main( int argc, char* args[] )
+int asset_worker(void *data)
 {
-  //Event handler
-  SDL_Event e;
+  int worker, i;
   
-  // Init quit flag
-  quit=0;
-  
-  // Initialize random seed
-  srand(time(NULL));
-  
-  
-  // Start up SDL and create window
-  init();
+  worker=(int)(intptr_t)data;
+  // Take jobs until the queue is empty
+  while((i=SDL_AtomicAdd(&asset_next, 1)) < asset_jobs_size)
+  {
+    asset_jobs[i].worker=worker;
+    asset_jobs[i].start=SDL_GetPerformanceCounter();
+    asset_run(&asset_jobs[i]);
+    asset_jobs[i].end=SDL_GetPerformanceCounter();
+    SDL_AtomicAdd(&asset_done, 1);
+  }
+  return 0;
+}
+
+void load_assets()
+{
+  SDL_Thread *workers[ASSET_WORKERS_MAX];
+  Uint64 start;
+  char name[48];
+  int i, workers_size;
   
-  // Load Media
-  load_media();
+  // One worker per core, the render thread keeps the loading screen going
+  workers_size=SDL_GetCPUCount();
+  if(workers_size>ASSET_WORKERS_MAX) workers_size=ASSET_WORKERS_MAX;
+  if(workers_size>asset_jobs_size) workers_size=asset_jobs_size;
+  if(workers_size<1) workers_size=1;
   
-  // Main game loop
-  while(!quit)
+  start=SDL_GetPerformanceCounter();
+  SDL_AtomicSet(&asset_next, 0);
+  SDL_AtomicSet(&asset_done, 0);
+  for(i=0; i<workers_size; i++)
   {
-    //Handle events on queue
-    while( SDL_PollEvent( &e ) != 0 )
+    workers[i]=SDL_CreateThread(asset_worker, "asset_worker", (void*)(intptr_t)(i+1));
+    if(workers[i] == NULL)
     {
-      process_input(&e);
+      printf( "Unable to start asset worker! SDL Error: %s\n", SDL_GetError() );
+      exit(-1);
     }
-    // Render
-    sync_render();
   }
   
+  while(SDL_AtomicGet(&asset_done) < asset_jobs_size)
+  {
+    SDL_PumpEvents();
+    begin_frame();
+    render_loading(SDL_AtomicGet(&asset_done), asset_jobs_size);
+    end_frame();
+    SDL_RenderPresent(sdl_renderer);
+    SDL_Delay(10);
+  }
+  for(i=0; i<workers_size; i++)
+  {
+    SDL_WaitThread(workers[i], NULL);
+  }
+  startup_add("asset decoding (wall)", 0, start, SDL_GetPerformanceCounter());
   
-  close_sdl();
-  return 0;
+  for(i=0; i<asset_jobs_size; i++)
+  {
+    snprintf(name, sizeof(name), "decode %s", asset_jobs[i].path != NULL ? asset_jobs[i].path : "uncached atlas");
+    startup_add(name, asset_jobs[i].worker, asset_jobs[i].start, asset_jobs[i].end);
+  }
+  SDL_DestroyMutex(font_mutex);
+  font_mutex=NULL;
 }
 
-//-----------------------------------------------------------------------------------------
-
-
-#define MAGAZINE_SIZE 4
-#define BULLETS_SIZE 100
-#define DUCK_WIDTH 40
-#define DUCK_HEIGHT 30
-#define ANGLE_BULLET 35.0*M_PI/180.0
-#define SPEED_BULLET 30.0
-#define DUCK_SPEED 3
-#define DUCK_START_X 0
-
-
-struct bullet
+void render_loading(int done, int total)
 {
-  int enabled;
-  int x;
-  int y;
-  int vx;
-  int vy;
-  int player;
-};
+  SDL_Rect sdl_rect;
+  int i, phase;
+  
+  //Clear screen
+  SDL_SetRenderDrawColor( sdl_renderer, 0x00, 0x00, 0x00, 0xFF );
+  SDL_RenderClear( sdl_renderer );
+  
+  // Progress bar
+  SDL_SetRenderDrawColor( sdl_renderer, 0x46, 0x46, 0x46, 0xFF );
+  sdl_rect.w=SCREEN_WIDTH/2;
+  sdl_rect.h=20;
+  sdl_rect.x=SCREEN_WIDTH/4;
+  sdl_rect.y=SCREEN_HEIGHT/2;
+  SDL_RenderFillRect(sdl_renderer, &sdl_rect);
+  SDL_SetRenderDrawColor( sdl_renderer, 0xFF, 0xFF, 0xFF, 0xFF );
+  sdl_rect.w=sdl_rect.w*done/total;
+  SDL_RenderFillRect(sdl_renderer, &sdl_rect);
+  
+  // Dots chasing each other, shows the render thread is alive
+  phase=SDL_GetTicks()/100;
+  sdl_rect.w=10;
+  sdl_rect.h=10;
+  sdl_rect.y=SCREEN_HEIGHT/2-30;
+  for(i=0; i<5; i++)
+  {
+    sdl_rect.x=SCREEN_WIDTH/2-45+20*i;
+    if(phase%5==i)
+    {
+      SDL_SetRenderDrawColor( sdl_renderer, 0xFF, 0xFF, 0xFF, 0xFF );
+    }
+    else
+    {
+      SDL_SetRenderDrawColor( sdl_renderer, 0x46, 0x46, 0x46, 0xFF );
+    }
+    SDL_RenderFillRect(sdl_renderer, &sdl_rect);
+  }
+}
 
-struct duck
+void startup_add(const char *name, int thread, Uint64 start, Uint64 end)
 {
-  int enabled;
-  unsigned int shoot_time;
-  int x;
-  int y;
-  int vx;
-  int vy;
-};
+  struct startup_step *step;
+  
+  if(startup_steps_size == STARTUP_STEPS_SIZE) return;
+  step=&startup_steps[startup_steps_size++];
+  snprintf(step->name, sizeof(step->name), "%s", name);
+  step->thread=thread;
+  step->start=start;
+  step->end=end;
+}
 
-struct shot_gun
+void startup_report()
 {
-  int magazine;
-  unsigned int cocking_time;
-};
+  struct startup_step *step;
+  double frequency_ms, decode_ms;
+  int i;
+  
+  frequency_ms=SDL_GetPerformanceFrequency()/1000.0;
+  decode_ms=0;
+  printf("Startup report, ms since process start\n");
+  printf("%9s %9s %7s  %s\n", "start", "duration", "thread", "step");
+  for(i=0; i<startup_steps_size; i++)
+  {
+    step=&startup_steps[i];
+    printf("%9.2f %9.2f %7s  %s\n", (step->start-startup_counter)/frequency_ms, (step->end-step->start)/frequency_ms,
+	   step->thread==0 ? "render" : "worker", step->name);
+    if(step->thread>0)
+    {
+      decode_ms+=(step->end-step->start)/frequency_ms;
+    }
+  }
+  printf("Asset decoding: %.2f ms of work on %d jobs\n", decode_ms, asset_jobs_size);
+  printf("Time to first frame: %.2f ms\n", (SDL_GetPerformanceCounter()-startup_counter)/frequency_ms);
+}
 
-struct hunter
+void loadTFTTexture(struct sized_texture *texture, TTF_Font *font, char* text, SDL_Color color)
 {
-  int x,y,score;
-};
-
-void init_ball();
-void fire(int);
-void cock(int);
-void process_start_button();
-void process_select_button();
-
-
-
-
-
-// Fire sound
-Mix_Chunk *fire_chunk = NULL;
-Mix_Chunk *fire_dry_chunk = NULL;
-Mix_Chunk *cocking_chunk = NULL;
-Mix_Chunk *quack_chunk = NULL;
-
-
-
-struct sized_texture texture_background;
-struct sized_texture texture_hunter;
-struct sized_texture texture_bulllet;
-struct sized_texture texture_sprites;
-
-
-/** GAME DATA **/
-struct hunter hunters[2];
-struct shot_gun shotgun[2];
-struct bullet bullets[BULLETS_SIZE];
-struct duck ducks[20];
-int ducks_size;
-int hunter_height;
-int hunter_width;
-int duck_height;
-int duck_width;
-double speed_bullet;
-
+  //The final texture
+  texture->texture = NULL;
+    
+  //Load image at specified path
+  SDL_Surface *loadedSurface = TTF_RenderText_Solid( font, text, color );
+  if( loadedSurface == NULL )
+  {
+    printf( "Unable to render text! SDL_image Error: %s\n", TTF_GetError() );
+    exit(-1);
+  }
+  else
+  {
+    //printf("Surface: %d, %d\n", loadedSurface->w, loadedSurface->h);
+    
+    //Create texture from surface pixels
+    texture->texture = SDL_CreateTextureFromSurface(sdl_renderer, loadedSurface );
+    if( texture->texture == NULL )
+    {
+      printf( "Unable to create texture! SDL Error: %s\n", SDL_GetError() );
+      exit(-1);
+    }
+    else {
+      //Get image dimensions 
+      texture->width = loadedSurface->w; 
+      texture->height = loadedSurface->h;      
+    }
+    
+    //Get rid of old loaded surface
+    SDL_FreeSurface( loadedSurface );
+  }
+  
+}
 
-void load_media()
-{ 
-  //Load background 
-  load_texture(&texture_background, "field.png"); 
+void init_text()
+{
+  batch_init(&text_batch, QUAD_BATCH_SIZE);
   
-  //Load hunter 
-  load_texture(&texture_hunter, "hunter.png"); 
+  // Rasterise every font once
+  load_glyph_atlas(&atlas_small, font_small);
+  load_glyph_atlas(&atlas_medium, font_medium);
+  load_glyph_atlas(&atlas_big, font_big);
+  load_glyph_atlas(&atlas_roboto, font_roboto);
   
-  //Load bullet 
-  load_texture(&texture_bulllet, "bullet.png");
+  // Warm static text cache so the first frames do not rasterise
+  text_cache_size=0;
+  get_static_text(font_medium, "1 Player", color_white);
+  get_static_text(font_medium, "1 Player", color_grey);
+  get_static_text(font_medium, "2 Players", color_white);
+  get_static_text(font_medium, "2 Players", color_grey);
+  get_static_text(font_big, "GAME OVER", color_black);
+  get_static_text(font_big, "PAUSE", color_black);
+}
+
+void close_text()
+{
+  int i;
   
-  // Load sprites
-  load_texture(&texture_sprites, "duckhunt_sprites.png");
+  // Destroy atlases
+  SDL_DestroyTexture(atlas_small.texture);
+  SDL_DestroyTexture(atlas_medium.texture);
+  SDL_DestroyTexture(atlas_big.texture);
+  SDL_DestroyTexture(atlas_roboto.texture);
   
-  // Load firing chunk
-  fire_chunk = Mix_LoadWAV("firing.wav");
+  // Destroy cached text
+  for(i=0; i<text_cache_size; i++)
+  {
+    SDL_DestroyTexture(text_cache[i].texture.texture);
+  }
+  text_cache_size=0;
   
-  // Load dry firing chunk
-  fire_dry_chunk = Mix_LoadWAV("firing_dry.wav");
+  batch_free(&text_batch);
+}
+
+void load_glyph_atlas(struct glyph_atlas *atlas, TTF_Font *font)
+{
+  SDL_Surface *glyph_surfaces[GLYPH_COUNT];
+  SDL_Surface *atlas_surface;
+  SDL_Rect sdl_rect;
+  char text[2];
+  int i, j, x, y, row_height, minx;
   
-  // Load cooking chunk
-  cocking_chunk = Mix_LoadWAV("cocking.wav");
+  atlas->font=font;
+  atlas->line_height=TTF_FontHeight(font);
+  text[1]='\0';
   
-  // Load quack
-  quack_chunk = Mix_LoadWAV("quack.wav");
+  // Render each glyph and lay it out in shelves
+  x=0;
+  y=0;
+  row_height=0;
+  for(i=0; i<GLYPH_COUNT; i++)
+  {
+    text[0]=GLYPH_FIRST+i;
+    TTF_GlyphMetrics(font, text[0], &minx, NULL, NULL, NULL, &atlas->glyphs[i].advance);
+    atlas->glyphs[i].offset = minx<0 ? minx : 0;
+    
+    glyph_surfaces[i] = TTF_RenderText_Solid(font, text, color_white);
+    if(glyph_surfaces[i] == NULL)
+    {
+      // Blank glyph (e.g. space), only advances the pen
+      atlas->glyphs[i].src.x=0;
+      atlas->glyphs[i].src.y=0;
+      atlas->glyphs[i].src.w=0;
+      atlas->glyphs[i].src.h=0;
+      continue;
+    }
+    
+    if(x+glyph_surfaces[i]->w > GLYPH_ATLAS_WIDTH)
+    {
+      x=0;
+      y+=row_height+1;
+      row_height=0;
+    }
+    atlas->glyphs[i].src.x=x;
+    atlas->glyphs[i].src.y=y;
+    atlas->glyphs[i].src.w=glyph_surfaces[i]->w;
+    atlas->glyphs[i].src.h=glyph_surfaces[i]->h;
+    x+=glyph_surfaces[i]->w+1;
+    if(glyph_surfaces[i]->h > row_height)
+    {
+      row_height=glyph_surfaces[i]->h;
+    }
+  }
+  atlas->width=GLYPH_ATLAS_WIDTH;
+  atlas->height=y+row_height;
   
+  // Kerning table
+  for(i=0; i<GLYPH_COUNT; i++)
+  {
+    for(j=0; j<GLYPH_COUNT; j++)
+    {
+      atlas->kerning[i][j]=TTF_GetFontKerningSizeGlyphs(font, GLYPH_FIRST+i, GLYPH_FIRST+j);
+    }
+  }
+  
+  // Copy glyphs into a transparent surface
+  atlas_surface = SDL_CreateRGBSurfaceWithFormat(0, atlas->width, atlas->height, 32, SDL_PIXELFORMAT_ARGB8888);
+  if(atlas_surface == NULL)
+  {
+    printf( "Unable to create glyph atlas! SDL Error: %s\n", SDL_GetError() );
+    exit(-1);
+  }
+  for(i=0; i<GLYPH_COUNT; i++)
+  {
+    if(glyph_surfaces[i] != NULL)
+    {
+      sdl_rect=atlas->glyphs[i].src;
+      SDL_BlitSurface(glyph_surfaces[i], NULL, atlas_surface, &sdl_rect);
+      SDL_FreeSurface(glyph_surfaces[i]);
+    }
+  }
+  
+  // Upload atlas
+  atlas->texture = SDL_CreateTextureFromSurface(sdl_renderer, atlas_surface);
+  if(atlas->texture == NULL)
+  {
+    printf( "Unable to create glyph atlas texture! SDL Error: %s\n", SDL_GetError() );
+    exit(-1);
+  }
+  SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+  SDL_FreeSurface(atlas_surface);
+}
+
+void batch_init(struct quad_batch *batch, int capacity)
+{
+  memset(batch, 0, sizeof(struct quad_batch));
+  batch->capacity=capacity;
+  batch->vertices=malloc(capacity*4*sizeof(SDL_Vertex));
+  batch->indices=malloc(capacity*6*sizeof(int));
+  if(batch->vertices==NULL || batch->indices==NULL)
+  {
+    printf("Unable to allocate quad batch of %d quads\n", capacity);
+    exit(-1);
+  }
+}
+
+void batch_free(struct quad_batch *batch)
+{
+  free(batch->vertices);
+  free(batch->indices);
+  memset(batch, 0, sizeof(struct quad_batch));
+}
+
+void batch_add_quad(struct quad_batch *batch, SDL_Texture *texture, SDL_Rect *src, SDL_Rect *dst, SDL_Color color, SDL_RendererFlip flip)
+{
+  SDL_Vertex *v;
+  int *idx;
+  int w, h, base;
+  float u0, u1, v0, v1;
+  
+  // Switching texture, submit pending quads
+  if(batch->texture != texture)
+  {
+    batch_flush(batch);
+    batch->texture=texture;
+    SDL_QueryTexture(texture, NULL, NULL, &batch->texture_width, &batch->texture_height);
+  }
+  
+  // Full batch, grow it so it is still submitted in one call
+  if(batch->quads == batch->capacity)
+  {
+    batch->capacity*=2;
+    batch->vertices=realloc(batch->vertices, batch->capacity*4*sizeof(SDL_Vertex));
+    batch->indices=realloc(batch->indices, batch->capacity*6*sizeof(int));
+    if(batch->vertices==NULL || batch->indices==NULL)
+    {
+      printf("Unable to grow quad batch to %d quads\n", batch->capacity);
+      exit(-1);
+    }
+  }
+  
+  // Texture coordinates, flips are baked in by swapping them
+  w=batch->texture_width;
+  h=batch->texture_height;
+  u0=(float)src->x/w;
+  u1=(float)(src->x+src->w)/w;
+  v0=(float)src->y/h;
+  v1=(float)(src->y+src->h)/h;
+  if(flip & SDL_FLIP_HORIZONTAL)
+  {
+    u0=(float)(src->x+src->w)/w;
+    u1=(float)src->x/w;
+  }
+  if(flip & SDL_FLIP_VERTICAL)
+  {
+    v0=(float)(src->y+src->h)/h;
+    v1=(float)src->y/h;
+  }
+  
+  // Corners: top left, top right, bottom right, bottom left
+  base=batch->quads*4;
+  v=&batch->vertices[base];
+  v[0].position.x=dst->x;
+  v[0].position.y=dst->y;
+  v[0].tex_coord.x=u0;
+  v[0].tex_coord.y=v0;
+  v[1].position.x=dst->x+dst->w;
+  v[1].position.y=dst->y;
+  v[1].tex_coord.x=u1;
+  v[1].tex_coord.y=v0;
+  v[2].position.x=dst->x+dst->w;
+  v[2].position.y=dst->y+dst->h;
+  v[2].tex_coord.x=u1;
+  v[2].tex_coord.y=v1;
+  v[3].position.x=dst->x;
+  v[3].position.y=dst->y+dst->h;
+  v[3].tex_coord.x=u0;
+  v[3].tex_coord.y=v1;
+  v[0].color=color;
+  v[1].color=color;
+  v[2].color=color;
+  v[3].color=color;
+  
+  // Two triangles
+  idx=&batch->indices[batch->quads*6];
+  idx[0]=base;
+  idx[1]=base+1;
+  idx[2]=base+2;
+  idx[3]=base;
+  idx[4]=base+2;
+  idx[5]=base+3;
+  
+  batch->quads++;
+}
+
+void batch_flush(struct quad_batch *batch)
+{
+  if(batch->quads>0)
+  {
+    SDL_RenderGeometry(sdl_renderer, batch->texture, batch->vertices, batch->quads*4, batch->indices, batch->quads*6);
+    batch->quads=0;
+  }
+}
+
+int text_width(struct glyph_atlas *atlas, const char *text)
+{
+  int width, c, prev;
+  
+  width=0;
+  prev=-1;
+  for(; *text; text++)
+  {
+    c=*text-GLYPH_FIRST;
+    if(c<0 || c>=GLYPH_COUNT) continue;
+    if(prev>=0)
+    {
+      width+=atlas->kerning[prev][c];
+    }
+    width+=atlas->glyphs[c].advance;
+    prev=c;
+  }
+  return width;
+}
+
+void draw_text(struct glyph_atlas *atlas, const char *text, int x, int y, SDL_Color color)
+{
+  SDL_Rect sdl_rect;
+  int c, prev;
+  
+  prev=-1;
+  for(; *text; text++)
+  {
+    c=*text-GLYPH_FIRST;
+    if(c<0 || c>=GLYPH_COUNT) continue;
+    if(prev>=0)
+    {
+      x+=atlas->kerning[prev][c];
+    }
+    if(atlas->glyphs[c].src.w>0)
+    {
+      sdl_rect.x=x+atlas->glyphs[c].offset;
+      sdl_rect.y=y;
+      sdl_rect.w=atlas->glyphs[c].src.w;
+      sdl_rect.h=atlas->glyphs[c].src.h;
+      batch_add_quad(&text_batch, atlas->texture, &atlas->glyphs[c].src, &sdl_rect, color, SDL_FLIP_NONE);
+    }
+    x+=atlas->glyphs[c].advance;
+    prev=c;
+  }
+  batch_flush(&text_batch);
+}
+
+struct sized_texture* get_static_text(TTF_Font *font, const char *text, SDL_Color color)
+{
+  struct text_cache_entry *entry;
+  int i;
+  
+  // Look up cached texture
+  for(i=0; i<text_cache_size; i++)
+  {
+    entry=&text_cache[i];
+    if(entry->font == font && strcmp(entry->text, text) == 0
+      && entry->color.r == color.r && entry->color.g == color.g
+      && entry->color.b == color.b && entry->color.a == color.a)
+    {
+      return &entry->texture;
+    }
+  }
+  
+  // Not cached, render it once
+  if(text_cache_size == TEXT_CACHE_SIZE)
+  {
+    printf( "Static text cache full!\n" );
+    exit(-1);
+  }
+  entry=&text_cache[text_cache_size++];
+  entry->font=font;
+  entry->text=text;
+  entry->color=color;
+  loadTFTTexture(&entry->texture, font, (char*)text, color);
+  return &entry->texture;
+}
+
+void sync_render()
+{
+  Uint64 start, end, phase_start, frame_period;
+  
+  // Newest state the simulation published
+  start = SDL_GetPerformanceCounter();
+  snapshot_acquire();
+  
+  // Render screen
+  render_frames++;
+  phase_start = SDL_GetPerformanceCounter();
+  begin_frame();
+  if(view->players_menu)
+  {
+    render_menu();
+  }
+  else
+  {
+    render();  
+  }
+  end_frame();
+  end = SDL_GetPerformanceCounter();
+  profile_add(PHASE_DRAW, phase_start, end);
+  
+  //Update screen
+  phase_start = end;
+  SDL_RenderPresent(sdl_renderer);
+  end = SDL_GetPerformanceCounter();
+  profile_add(PHASE_PRESENT, phase_start, end);
+  
+  // First frame showing a press, the time it took to get on screen
+  if(view->input_counter != latency_last)
+  {
+    latency_last = view->input_counter;
+    profile_add(PHASE_INPUT_LATENCY, latency_last, end);
+  }
+  
+  if(!startup_reported)
+  {
+    startup_add("first frame", 0, phase_start, end);
+    startup_report();
+    startup_reported=1;
+  }
+  
+  if(render_frames%GOVERNOR_WINDOW==0)
+  {
+    phase_start = end;
+    read_temp();
+    end = SDL_GetPerformanceCounter();
+    profile_add(PHASE_TEMP, phase_start, end);
+  }
+  
+  render_time = (end - start) * 1000 / perf_frequency;
+  
+  // Budget is the frame period asked for, none when uncapped
+  frame_period = render_rate > 0 && !replay_fast ? perf_frequency / frame_rate() : 0;
+  if(governor_enabled)
+  {
+    governor_frame(end - start, frame_period);
+    if(render_frames%GOVERNOR_WINDOW==0)
+    {
+      governor_update();
+    }
+  }
+  
+  // 60 fps -> 16ms
+  // 30 fps -> 32ms
+  // 50 fps -> 20ms
+  // 100 fps -> 10ms
+  if(frame_period > 0)
+  {
+    if(end - start < frame_period)
+    {
+      phase_start = end;
+      SDL_Delay((frame_period - (end - start)) * 1000 / perf_frequency);
+      profile_add(PHASE_SLEEP, phase_start, SDL_GetPerformanceCounter());
+    }
+    else
+    {
+      printf("Render time: %ud !!!!\n", render_time);
+    }
+  }
+}
+
+void sim_step()
+{
+  Uint64 start, tick_period;
+  int ticks, tail, next, changed;
+  
+  start = SDL_GetPerformanceCounter();
+  accumulator += start - last_counter;
+  last_counter = start;
+  tick_period = perf_frequency / sim_rate;
+  
+  // Stopped (menus, pause): inputs and logged inputs go in as they come
+  ticks=0;
+  changed=0;
+  if(game_over || pause || players_menu)
+  {
+    tail = SDL_AtomicGet(&input_tail);
+    next = replay_next;
+    input_drain(start, start);
+    if(replay_path != NULL)
+    {
+      replay_input();
+    }
+    changed = tail != SDL_AtomicGet(&input_tail) || next != replay_next;
+  }
+  
+  if(!game_over && !pause && !players_menu)
+  {
+    // Fast replay ignores the clock, ticks per frame as if it was real time
+    if(replay_fast)
+    {
+      accumulator = render_rate > 0 && sim_rate > render_rate ? tick_period * (sim_rate / render_rate) : tick_period;
+    }
+    
+    // Run as many fixed ticks as time elapsed
+    while(accumulator >= tick_period && ticks < MAX_TICKS_PER_FRAME && !game_over && !quit)
+    {
+      // Inputs that happened during this tick, at their place in it
+      input_drain(last_counter - accumulator, last_counter - accumulator + tick_period);
+      
+      // Logged inputs go in before the tick they preceded
+      if(replay_path != NULL)
+      {
+	replay_input();
+	if(quit) break;
+      }
+      // Count frames
+      frames++;
+      // Update game data
+      update_game();
+      accumulator -= tick_period;
+      ticks++;
+    }
+    // Too far behind, drop the ticks we cannot catch up
+    if(accumulator >= tick_period)
+    {
+      accumulator %= tick_period;
+    }
+    if(ticks>0)
+    {
+      SDL_AtomicAdd(&profile_sequence, 1);
+      SDL_MemoryBarrierRelease();
+      profile_add(PHASE_UPDATE, start, SDL_GetPerformanceCounter());
+      profile_ticks = frames;
+      SDL_MemoryBarrierRelease();
+      SDL_AtomicAdd(&profile_sequence, 1);
+    }
+  }
+  else
+  {
+    // Stopped simulation does not accumulate time
+    accumulator = 0;
+  }
+  
+  // Hand the state over to the renderer, only when it changed: copying
+  // the pools is not free
+  if(ticks>0 || changed)
+  {
+    snapshot_publish();
+  }
+}
+
+int sim_worker(void *data)
+{
+  Uint64 tick_period, due, now;
+  
+  while(!quit)
+  {
+    sim_step();
+    
+    // Sleep until the next tick is due, fast replays never wait
+    if(!replay_fast)
+    {
+      tick_period = perf_frequency / sim_rate;
+      due = last_counter + tick_period - accumulator;
+      now = SDL_GetPerformanceCounter();
+      if(now < due)
+      {
+	// Rounded up, waking early would only spin until the tick is due
+	SDL_Delay(((due - now) * 1000 + perf_frequency - 1) / perf_frequency);
+      }
+    }
+  }
+  return 0;
+}
+
+void init_sim()
+{
+  // Renderer starts on slot 0, the first snapshot goes through slot 2
+  snapshot_read = 0;
+  snapshot_write = 2;
+  SDL_AtomicSet(&snapshot_newest, 1);
+  snapshot_publish();
+  snapshot_acquire();
+  SDL_AtomicSet(&input_head, 0);
+  SDL_AtomicSet(&input_tail, 0);
+  
+  if(sim_threaded)
+  {
+    sim_thread = SDL_CreateThread(sim_worker, "simulation", NULL);
+    if(sim_thread == NULL)
+    {
+      printf( "Unable to start simulation thread! SDL Error: %s\n", SDL_GetError() );
+      exit(-1);
+    }
+  }
+}
+
+void close_sim()
+{
+  int i;
+  
+  // Quit is set, the thread ends after its current step
+  if(sim_thread != NULL)
+  {
+    SDL_WaitThread(sim_thread, NULL);
+    sim_thread = NULL;
+  }
+  for(i=0; i<3; i++)
+  {
+    free_snapshot(&snapshots[i]);
+  }
+  view = NULL;
+}
+
+void snapshot_publish()
+{
+  struct snapshot *snapshot;
+  
+  snapshot = &snapshots[snapshot_write];
+  snapshot->counter = last_counter - accumulator;
+  snapshot->frames = frames;
+  snapshot->players = players;
+  snapshot->players_menu = players_menu;
+  snapshot->game_over = game_over;
+  snapshot->pause = pause;
+  snapshot->input_counter = input_applied;
+  save_snapshot(snapshot);
+  
+  // Written slot becomes the newest, the previous newest is written next
+  SDL_MemoryBarrierRelease();
+  snapshot_write = SDL_AtomicSet(&snapshot_newest, snapshot_write | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+}
+
+void snapshot_acquire()
+{
+  Uint64 now, tick_period;
+  
+  // Swap in the newest slot when there is one the renderer has not taken
+  if(SDL_AtomicGet(&snapshot_newest) & SNAPSHOT_FRESH)
+  {
+    snapshot_read = SDL_AtomicSet(&snapshot_newest, snapshot_read) & ~SNAPSHOT_FRESH;
+    SDL_MemoryBarrierAcquire();
+  }
+  view = &snapshots[snapshot_read];
+  
+  // Fraction of a tick since its state, a stopped game does not move
+  if(view->game_over || view->pause || view->players_menu)
+  {
+    render_alpha = 1.0;
+  }
+  else
+  {
+    now = SDL_GetPerformanceCounter();
+    tick_period = perf_frequency / sim_rate;
+    if(now <= view->counter)
+    {
+      render_alpha = 0.0;
+    }
+    else if(now - view->counter >= tick_period)
+    {
+      render_alpha = 1.0;
+    }
+    else
+    {
+      render_alpha = (double)(now - view->counter) / tick_period;
+    }
+  }
+}
+
+void begin_frame()
+{
+  int width, height;
+  
+  // Window already at the internal resolution, draw straight into it
+  render_target_bound = render_scale < 100 || SCREEN_WIDTH != WINDOW_WIDTH || SCREEN_HEIGHT != WINDOW_HEIGHT;
+  if(!render_target_bound) return;
+  
+  // Internal resolution, smaller when the governor asks for it
+  if(render_target == NULL || render_target_scale != render_scale)
+  {
+    if(render_target != NULL)
+    {
+      SDL_DestroyTexture(render_target);
+    }
+    width = SCREEN_WIDTH*render_scale/100;
+    height = SCREEN_HEIGHT*render_scale/100;
+    render_target = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, width, height);
+    if(render_target == NULL)
+    {
+      printf( "Unable to create %dx%d render target! SDL Error: %s\n", width, height, SDL_GetError() );
+      exit(-1);
+    }
+    SDL_SetTextureScaleMode(render_target, upscale_linear ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+    render_target_scale = render_scale;
+  }
+  SDL_SetRenderTarget(sdl_renderer, render_target);
+  SDL_RenderSetScale(sdl_renderer, render_scale/100.0f, render_scale/100.0f);
+}
+
+void end_frame()
+{
+  if(!render_target_bound) return;
+  
+  // Single upscale pass to the window
+  SDL_SetRenderTarget(sdl_renderer, NULL);
+  if(present_rect.w != WINDOW_WIDTH || present_rect.h != WINDOW_HEIGHT)
+  {
+    // Black bars when the aspect ratios differ
+    SDL_SetRenderDrawColor( sdl_renderer, 0x00, 0x00, 0x00, 0xFF );
+    SDL_RenderClear( sdl_renderer );
+  }
+  SDL_RenderCopy(sdl_renderer, render_target, NULL, &present_rect);
+}
+
+int layer_begin(struct render_layer *layer, int x, int y, int w, int h, int transparent)
+{
+  // Created, or moved to a new size
+  if(layer->texture == NULL || layer->rect.w != w || layer->rect.h != h)
+  {
+    if(layer->texture != NULL)
+    {
+      SDL_DestroyTexture(layer->texture);
+    }
+    layer->texture = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, w, h);
+    if(layer->texture == NULL)
+    {
+      printf( "Unable to create %dx%d layer! SDL Error: %s\n", w, h, SDL_GetError() );
+      exit(-1);
+    }
+    layer->dirty = 1;
+  }
+  if(layer->transparent != transparent || layer->resets != render_targets_reset)
+  {
+    layer->dirty = 1;
+  }
+  layer->rect.x = x;
+  layer->rect.y = y;
+  layer->rect.w = w;
+  layer->rect.h = h;
+  layer->transparent = transparent;
+  if(!layer->dirty) return 0;
+  
+  // Draw into the layer at its own size, from a cleared texture
+  SDL_SetTextureBlendMode(layer->texture, transparent ? SDL_BLENDMODE_BLEND : SDL_BLENDMODE_NONE);
+  SDL_SetRenderTarget(sdl_renderer, layer->texture);
+  SDL_RenderSetScale(sdl_renderer, 1.0f, 1.0f);
+  SDL_SetRenderDrawColor( sdl_renderer, 0x00, 0x00, 0x00, transparent ? 0x00 : 0xFF );
+  SDL_RenderClear( sdl_renderer );
+  return 1;
+}
+
+void layer_end(struct render_layer *layer)
+{
+  // Back to the frame being drawn
+  SDL_SetRenderTarget(sdl_renderer, render_target_bound ? render_target : NULL);
+  if(render_target_bound)
+  {
+    SDL_RenderSetScale(sdl_renderer, render_scale/100.0f, render_scale/100.0f);
+  }
+  layer->dirty = 0;
+  layer->resets = render_targets_reset;
+}
+
+void layer_draw(struct render_layer *layer)
+{
+  SDL_RenderCopy(sdl_renderer, layer->texture, NULL, &layer->rect);
+}
+
+void layer_free(struct render_layer *layer)
+{
+  if(layer->texture != NULL)
+  {
+    SDL_DestroyTexture(layer->texture);
+    layer->texture = NULL;
+  }
+}
+#endif
+
+void parse_args(int argc, char* args[])
+{
+  int i, consumed;
+  
+  for(i=1; i<argc; i++)
+  {
+    if(strcmp(args[i], "--tick-rate")==0 && i+1<argc)
+    {
+      sim_rate=atoi(args[++i]);
+      if(sim_rate < 10)
+      {
+	printf("Tick rate must be at least 10\n");
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--fps")==0 && i+1<argc)
+    {
+      render_rate=atoi(args[++i]);
+    }
+    else if(strcmp(args[i], "--profile")==0 && i+1<argc)
+    {
+      profile_prefix=args[++i];
+    }
+    else if(strcmp(args[i], "--pack")==0 && i+1<argc)
+    {
+      pack_path=args[++i];
+    }
+    else if(strcmp(args[i], "--no-pack")==0)
+    {
+      pack_path=NULL;
+    }
+    else if(strcmp(args[i], "--record")==0 && i+1<argc)
+    {
+      record_path=args[++i];
+    }
+    else if(strcmp(args[i], "--replay")==0 && i+1<argc)
+    {
+      replay_path=args[++i];
+    }
+    else if(strcmp(args[i], "--fast")==0)
+    {
+      replay_fast=1;
+    }
+    else if(strcmp(args[i], "--no-governor")==0)
+    {
+      governor_enabled=0;
+    }
+    else if(strcmp(args[i], "--governor-hot")==0 && i+1<argc)
+    {
+      governor_hot=atof(args[++i]);
+    }
+    else if(strcmp(args[i], "--governor-cool")==0 && i+1<argc)
+    {
+      governor_cool=atof(args[++i]);
+    }
+    else if(strcmp(args[i], "--governor-log")==0 && i+1<argc)
+    {
+      governor_log_path=args[++i];
+    }
+    else if(strcmp(args[i], "--players-max")==0 && i+1<argc)
+    {
+      players_max=atoi(args[++i]);
+      if(players_max < 2 || players_max > MAX_PLAYERS)
+      {
+	printf("Players must be between 2 and %d\n", MAX_PLAYERS);
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--no-sim-thread")==0)
+    {
+      sim_threaded=0;
+    }
+    else if(strcmp(args[i], "--no-input-thread")==0)
+    {
+      input_threaded=0;
+    }
+    else if(strcmp(args[i], "--input-poll-ms")==0 && i+1<argc)
+    {
+      input_interval=atoi(args[++i]);
+      if(input_interval < 1)
+      {
+	printf("Input poll interval must be at least 1ms\n");
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--latency-report")==0)
+    {
+      latency_report=1;
+    }
+    else if(strcmp(args[i], "--bench")==0 && i+1<argc)
+    {
+      bench_path=args[++i];
+    }
+    else if(strcmp(args[i], "--bench-baseline")==0 && i+1<argc)
+    {
+      bench_baseline_path=args[++i];
+    }
+    else if(strcmp(args[i], "--bench-scenario")==0 && i+1<argc)
+    {
+      bench_scenario=args[++i];
+    }
+    else if(strcmp(args[i], "--bench-iterations")==0 && i+1<argc)
+    {
+      bench_iterations=atoi(args[++i]);
+      if(bench_iterations < 1)
+      {
+	printf("Benchmark needs at least one iteration\n");
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--bench-tolerance")==0 && i+1<argc)
+    {
+      bench_tolerance=atof(args[++i]);
+    }
+    else if(strcmp(args[i], "--audio-rate")==0 && i+1<argc)
+    {
+      audio_rate=atoi(args[++i]);
+      if(audio_rate < 8000 || audio_rate > 192000)
+      {
+	printf("Audio rate must be between 8000 and 192000\n");
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--audio-buffer")==0 && i+1<argc)
+    {
+      // Samples, a power of two, or auto
+      i++;
+      audio_buffer=strcmp(args[i], "auto")==0 ? 0 : atoi(args[i]);
+      if(strcmp(args[i], "auto")!=0 && (audio_buffer < 64 || audio_buffer > AUDIO_BUFFER_MAX || (audio_buffer & (audio_buffer-1)) != 0))
+      {
+	printf("Audio buffer must be a power of two between 64 and %d, or auto\n", AUDIO_BUFFER_MAX);
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--offscreen")==0)
+    {
+      offscreen=1;
+    }
+    else if(strcmp(args[i], "--frame-hash")==0 && i+1<argc)
+    {
+      frame_hash_path=args[++i];
+    }
+    else if(strcmp(args[i], "--resolution")==0 && i+1<argc)
+    {
+      // WxH, or native to draw at the window size
+      i++;
+      if(strcmp(args[i], "native")==0)
+      {
+	internal_width=0;
+	internal_height=0;
+      }
+      else if(sscanf(args[i], "%dx%d", &internal_width, &internal_height) != 2 || internal_width < 320 || internal_height < 200)
+      {
+	printf("Resolution must be WxH, at least 320x200, or native\n");
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--upscale")==0 && i+1<argc)
+    {
+      i++;
+      if(strcmp(args[i], "linear")==0)
+      {
+	upscale_linear=1;
+      }
+      else if(strcmp(args[i], "nearest")==0)
+      {
+	upscale_linear=0;
+      }
+      else
+      {
+	printf("Upscale filter must be linear or nearest\n");
+	exit(-1);
+      }
+    }
+    else if(strcmp(args[i], "--telemetry-ms")==0 && i+1<argc)
+    {
+      telemetry_interval=atoi(args[++i]);
+      if(telemetry_interval < 10)
+      {
+	printf("Telemetry interval must be at least 10ms\n");
+	exit(-1);
+      }
+    }
+    // Game options
+    else if((consumed=process_arg(argc, args, i)) > 0)
+    {
+      i+=consumed-1;
+    }
+    else
+    {
+      printf("Usage: %s [--tick-rate ticks_per_second] [--fps frames_per_second (0 uncapped)] [--profile output_prefix] [--pack file | --no-pack] [--record file] [--replay file [--fast]] [--no-governor] [--governor-hot C] [--governor-cool C] [--governor-log file] [--telemetry-ms interval] [--resolution WxH|native] [--upscale linear|nearest] [--players-max n] [--no-sim-thread] [--no-input-thread] [--input-poll-ms interval] [--latency-report] [--audio-rate hz] [--audio-buffer samples|auto] [--bench output.json [--bench-baseline file] [--bench-scenario name] [--bench-iterations n] [--bench-tolerance percent] [--offscreen [--frame-hash file]]]", args[0]);
+      print_game_options();
+      printf("\n");
+      exit(-1);
+    }
+  }
+  if(replay_fast && replay_path == NULL)
+  {
+    printf("--fast needs --replay\n");
+    exit(-1);
+  }
+  if(governor_cool >= governor_hot)
+  {
+    printf("Governor cool threshold must be below the hot one\n");
+    exit(-1);
+  }
+  if((bench_baseline_path != NULL || bench_scenario != NULL || offscreen) && bench_path == NULL)
+  {
+    printf("--bench-baseline, --bench-scenario and --offscreen need --bench\n");
+    exit(-1);
+  }
+  if(frame_hash_path != NULL && !offscreen)
+  {
+    printf("--frame-hash needs --offscreen\n");
+    exit(-1);
+  }
+}
+
+void init_timing()
+{
+  perf_frequency = SDL_GetPerformanceFrequency();
+  last_counter = SDL_GetPerformanceCounter();
+  accumulator = 0;
+  render_alpha = 1.0;
+}
+
+void init_profile()
+{
+  static const char *names[PHASE_COUNT] = {"events", "update", "draw", "present", "temp", "sleep", "input_to_present"};
+  int i;
+  
+  memset(profile, 0, sizeof(profile));
+  for(i=0; i<PHASE_COUNT; i++)
+  {
+    profile[i].name=names[i];
+  }
+}
+
+void profile_add(int phase, Uint64 start, Uint64 end)
+{
+  histogram_add(&profile[phase], (end - start) * 1000000 / perf_frequency);
+}
+
+void histogram_add(struct histogram *histogram, Uint32 us)
+{
+  Uint32 bucket;
+  
+  if(histogram->count==0 || us < histogram->min_us)
+  {
+    histogram->min_us=us;
+  }
+  if(us > histogram->max_us)
+  {
+    histogram->max_us=us;
+  }
+  histogram->count++;
+  histogram->sum_us+=us;
+  
+  // Last bucket collects everything beyond the range
+  bucket=us/HISTOGRAM_BUCKET_US;
+  if(bucket > HISTOGRAM_BUCKETS)
+  {
+    bucket=HISTOGRAM_BUCKETS;
+  }
+  histogram->buckets[bucket]++;
+}
+
+Uint32 histogram_percentile(struct histogram *histogram, double percentile)
+{
+  Uint64 rank, seen;
+  Uint32 us;
+  int i;
+  
+  if(histogram->count==0) return 0;
+  
+  // Upper bound of the bucket holding the requested rank
+  rank=(Uint64)ceil(histogram->count * percentile / 100.0);
+  seen=0;
+  for(i=0; i<=HISTOGRAM_BUCKETS; i++)
+  {
+    seen+=histogram->buckets[i];
+    if(seen>=rank) break;
+  }
+  // Beyond the range only the largest sample is known
+  if(i>=HISTOGRAM_BUCKETS) return histogram->max_us;
+  us=(i+1)*HISTOGRAM_BUCKET_US;
+  if(us < histogram->min_us) return histogram->min_us;
+  return us < histogram->max_us ? us : histogram->max_us;
+}
+
+void histogram_write_json(FILE *file, struct histogram *histogram)
+{
+  fprintf(file, "{\"name\": \"%s\", \"count\": %llu, \"min_us\": %u, \"mean_us\": %.1f, \"p50_us\": %u, \"p95_us\": %u, \"p99_us\": %u, \"max_us\": %u}",
+	  histogram->name, (unsigned long long)histogram->count, histogram->min_us,
+	  histogram->count ? (double)histogram->sum_us/histogram->count : 0.0,
+	  histogram_percentile(histogram, 50), histogram_percentile(histogram, 95),
+	  histogram_percentile(histogram, 99), histogram->max_us);
+}
+
+void profile_dump()
+{
+  static struct histogram phases[PHASE_COUNT];
+  char path[256];
+  FILE *file;
+  struct histogram *h;
+  unsigned int ticks;
+  int i, before, after;
+  
+  // Copy first, the simulation thread may be adding an update time
+  do
+  {
+    before = SDL_AtomicGet(&profile_sequence);
+    SDL_MemoryBarrierAcquire();
+    memcpy(phases, profile, sizeof(phases));
+    ticks = profile_ticks;
+    SDL_MemoryBarrierAcquire();
+    after = SDL_AtomicGet(&profile_sequence);
+  }
+  while((before & 1) || before != after);
+  
+  // JSON report
+  snprintf(path, sizeof(path), "%s.json", profile_prefix);
+  file = fopen(path, "w");
+  if(file == NULL)
+  {
+    printf("Unable to write profile %s\n", path);
+    return;
+  }
+  fprintf(file, "{\"tick_rate\": %d, \"fps\": %d, \"ticks\": %u, \"frames\": %u, \"phases\": [\n",
+	  sim_rate, render_rate, ticks, render_frames);
+  for(i=0; i<PHASE_COUNT; i++)
+  {
+    fprintf(file, "  ");
+    histogram_write_json(file, &phases[i]);
+    fprintf(file, i<PHASE_COUNT-1 ? ",\n" : "\n");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  
+  // CSV report
+  snprintf(path, sizeof(path), "%s.csv", profile_prefix);
+  file = fopen(path, "w");
+  if(file == NULL)
+  {
+    printf("Unable to write profile %s\n", path);
+    return;
+  }
+  fprintf(file, "phase,count,min_us,mean_us,p50_us,p95_us,p99_us,max_us\n");
+  for(i=0; i<PHASE_COUNT; i++)
+  {
+    h=&phases[i];
+    fprintf(file, "%s,%llu,%u,%.1f,%u,%u,%u,%u\n", h->name, (unsigned long long)h->count, h->min_us,
+	    h->count ? (double)h->sum_us/h->count : 0.0,
+	    histogram_percentile(h, 50), histogram_percentile(h, 95), histogram_percentile(h, 99), h->max_us);
+  }
+  fclose(file);
+  
+  printf("Profile written to %s.json and %s.csv\n", profile_prefix, profile_prefix);
+}
+
+void bench_add(struct bench_samples *samples, Uint64 start, Uint64 end)
+{
+  // Raw ticks, percentiles are exact instead of histogram buckets
+  if(samples->count == samples->capacity)
+  {
+    samples->capacity = samples->capacity ? samples->capacity*2 : 1024;
+    samples->ticks = realloc(samples->ticks, samples->capacity*sizeof(Uint64));
+    if(samples->ticks == NULL)
+    {
+      printf("Unable to allocate %d benchmark samples\n", samples->capacity);
+      exit(-1);
+    }
+  }
+  samples->ticks[samples->count++] = end - start;
+}
+
+int bench_compare_ticks(const void *a, const void *b)
+{
+  Uint64 x = *(const Uint64*)a, y = *(const Uint64*)b;
+  
+  return x < y ? -1 : x > y;
+}
+
+void bench_record(const char *scenario, struct bench_samples *samples)
+{
+  static const double percentiles[3] = {50, 95, 99};
+  struct bench_result *result;
+  double ns[3];
+  int i, rank;
+  
+  if(bench_results_size == BENCH_RESULTS_SIZE)
+  {
+    printf("Too many benchmark results, %d kept\n", BENCH_RESULTS_SIZE);
+    exit(-1);
+  }
+  if(samples->count == 0) return;
+  
+  // Nearest rank percentiles of the sorted runs
+  qsort(samples->ticks, samples->count, sizeof(Uint64), bench_compare_ticks);
+  for(i=0; i<3; i++)
+  {
+    rank = (int)ceil(samples->count * percentiles[i] / 100.0) - 1;
+    ns[i] = samples->ticks[rank < 0 ? 0 : rank] * 1e9 / perf_frequency;
+  }
+  result = &bench_results[bench_results_size++];
+  snprintf(result->scenario, sizeof(result->scenario), "%s", scenario);
+  snprintf(result->measure, sizeof(result->measure), "%s", samples->name);
+  result->count = samples->count;
+  result->p50_ns = ns[0];
+  result->p95_ns = ns[1];
+  result->p99_ns = ns[2];
+  result->max_ns = samples->ticks[samples->count-1] * 1e9 / perf_frequency;
+  printf("%-12s %-10s p50 %10.0fns p95 %10.0fns p99 %10.0fns\n", result->scenario, result->measure,
+	 result->p50_ns, result->p95_ns, result->p99_ns);
+  samples->count = 0;
+}
+
+void bench_write(char *path)
+{
+  FILE *file;
+  struct bench_result *result;
+  int i;
+  
+  // One result per line, bench_check reads them back
+  file = fopen(path, "w");
+  if(file == NULL)
+  {
+    printf("Unable to write benchmark %s\n", path);
+    exit(-1);
+  }
+  fprintf(file, "{\"tick_rate\": %d, \"resolution\": \"%dx%d\", \"iterations\": %d, \"results\": [\n",
+	  sim_rate, SCREEN_WIDTH, SCREEN_HEIGHT, bench_iterations);
+  for(i=0; i<bench_results_size; i++)
+  {
+    result = &bench_results[i];
+    fprintf(file, "  {\"scenario\": \"%s\", \"measure\": \"%s\", \"count\": %d, \"p50_ns\": %.0f, \"p95_ns\": %.0f, \"p99_ns\": %.0f, \"max_ns\": %.0f}%s\n",
+	    result->scenario, result->measure, result->count, result->p50_ns, result->p95_ns, result->p99_ns, result->max_ns,
+	    i<bench_results_size-1 ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  printf("Benchmark written to %s\n", path);
+}
+
+int bench_check(char *path)
+{
+  FILE *file;
+  struct bench_result baseline, *result;
+  char line[512];
+  double change;
+  int i, regressions;
+  
+  file = fopen(path, "r");
+  if(file == NULL)
+  {
+    printf("No baseline %s to compare with\n", path);
+    return 0;
+  }
+  
+  // Medians against the ones of the same scenario and measure
+  regressions = 0;
+  while(fgets(line, sizeof(line), file) != NULL)
+  {
+    if(sscanf(line, " {\"scenario\": \"%31[^\"]\", \"measure\": \"%31[^\"]\", \"count\": %d, \"p50_ns\": %lf, \"p95_ns\": %lf",
+	      baseline.scenario, baseline.measure, &baseline.count, &baseline.p50_ns, &baseline.p95_ns) != 5)
+    {
+      continue;
+    }
+    for(i=0; i<bench_results_size; i++)
+    {
+      result = &bench_results[i];
+      if(strcmp(result->scenario, baseline.scenario) != 0 || strcmp(result->measure, baseline.measure) != 0) continue;
+      change = baseline.p50_ns > 0 ? (result->p50_ns - baseline.p50_ns) * 100.0 / baseline.p50_ns : 0.0;
+      printf("%-12s %-10s p50 %10.0fns baseline %10.0fns %+6.1f%%%s\n", result->scenario, result->measure,
+	     result->p50_ns, baseline.p50_ns, change, change > bench_tolerance ? " REGRESSION" : "");
+      if(change > bench_tolerance)
+      {
+	regressions++;
+      }
+    }
+  }
+  fclose(file);
+  
+  if(regressions > 0)
+  {
+    printf("%d measures more than %.1f%% slower than %s\n", regressions, bench_tolerance, path);
+  }
+  return regressions;
+}
+
+#ifndef HEADLESS
+Uint64 frame_hash()
+{
+  Uint64 hash;
+  Uint8 *row;
+  int x, y;
+  
+  // FNV-1a over the visible pixels, row padding left out
+  hash = 14695981039346656037ULL;
+  SDL_LockSurface(offscreen_surface);
+  for(y=0; y<offscreen_surface->h; y++)
+  {
+    row = (Uint8*)offscreen_surface->pixels + y*offscreen_surface->pitch;
+    for(x=0; x<offscreen_surface->w*4; x++)
+    {
+      hash = (hash ^ row[x]) * 1099511628211ULL;
+    }
+  }
+  SDL_UnlockSurface(offscreen_surface);
+  return hash;
+}
+
+void frame_hash_write(const char *scenario, int frame)
+{
+  if(frame_hash_file == NULL) return;
+  
+  // One "scenario frame hash" line per frame, diff two runs to compare
+  fprintf(frame_hash_file, "%s %d %016llx\n", scenario, frame, (unsigned long long)frame_hash());
+}
+#endif
+
+unsigned int sim_ticks(unsigned int base_ticks)
+{
+  unsigned int ticks;
+  
+  // Convert a duration in base rate ticks to simulation ticks
+  ticks = (base_ticks * sim_rate + SIM_BASE_RATE/2) / SIM_BASE_RATE;
+  return ticks > 0 ? ticks : 1;
+}
+
+int interpolate(int previous, int current)
+{
+  return previous + (int)lround((current - previous) * render_alpha);
+}
+
+void play_sound(Mix_Chunk *chunk, int group)
+{
+  // Headless build runs against a null mixer
+#ifndef HEADLESS
+  struct voice_group *voice_group;
+  int channel;
+  
+  // A free voice of the group, or one taken from a group that allows it
+  voice_group = &voice_groups[group];
+  channel = Mix_GroupAvailable(group);
+  if(channel < 0)
+  {
+    channel = voice_steal(voice_group->priority);
+    if(channel < 0)
+    {
+      voice_group->dropped++;
+      return;
+    }
+    voice_group->stolen++;
+  }
+  if(Mix_PlayChannel(channel, chunk, 0) < 0)
+  {
+    voice_group->dropped++;
+    return;
+  }
+  voice_group->played++;
+  
+  // Timed until the mixer runs, one play at a time
+  if(SDL_AtomicGet(&audio_pending) == 0)
+  {
+    audio_pending_counter = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&audio_pending, 1);
+  }
+#endif
+}
+
+#ifndef HEADLESS
+void open_audio()
+{
+  Uint64 start, frequency, period;
+  Uint16 format;
+  int buffer, rate, channels;
+  
+  // Smallest power of two holding AUDIO_PERIOD_MS, unless one is given
+  buffer = audio_buffer;
+  if(buffer == 0)
+  {
+    buffer = 64;
+    while(buffer*1000 < audio_rate*AUDIO_PERIOD_MS)
+    {
+      buffer *= 2;
+    }
+  }
+  
+  frequency = SDL_GetPerformanceFrequency();
+  while(1)
+  {
+    SDL_AtomicSet(&audio_callbacks, 0);
+    audio_max_gap = 0;
+    if(Mix_OpenAudio( audio_rate, MIX_DEFAULT_FORMAT, 2, buffer )<0) 
+    { 
+      printf( "SDL_mixer could not initialize! SDL_mixer Error: %s\n", Mix_GetError() );
+      exit(-1);
+    }
+    Mix_SetPostMix(audio_postmix, NULL);
+    Mix_QuerySpec(&rate, &format, &channels);
+    if(audio_buffer != 0 || buffer >= AUDIO_BUFFER_MAX) break;
+    
+    // Automatic size: kept when the mixer is called back on time, else
+    // the device cannot keep up and the buffer doubles
+    period = buffer * frequency / rate;
+    start = SDL_GetPerformanceCounter();
+    while(SDL_AtomicGet(&audio_callbacks) < AUDIO_PROBE_CALLBACKS
+	  && SDL_GetPerformanceCounter() - start < 4 * AUDIO_PROBE_CALLBACKS * period)
+    {
+      SDL_Delay(1);
+    }
+    if(SDL_AtomicGet(&audio_callbacks) >= AUDIO_PROBE_CALLBACKS && audio_max_gap < 2 * period) break;
+    Mix_CloseAudio();
+    buffer *= 2;
+  }
+  audio_rate = rate;
+  audio_buffer_opened = buffer;
+}
+
+void audio_postmix(void *data, Uint8 *stream, int length)
+{
+  Uint64 now, buffer_time;
+  
+  // Runs on the audio thread after every mix. Gaps count from the second
+  // callback on, the first one waits for the device to start
+  now = SDL_GetPerformanceCounter();
+  if(SDL_AtomicGet(&audio_callbacks) > 1 && now - audio_last_callback > audio_max_gap)
+  {
+    audio_max_gap = now - audio_last_callback;
+  }
+  audio_last_callback = now;
+  SDL_AtomicAdd(&audio_callbacks, 1);
+  
+  // A play reaches the output once this buffer has been played
+  if(SDL_AtomicGet(&audio_pending))
+  {
+    buffer_time = (Uint64)audio_buffer_opened * SDL_GetPerformanceFrequency() / audio_rate;
+    histogram_add(&audio_latency, (now - audio_pending_counter + buffer_time) * 1000000 / SDL_GetPerformanceFrequency());
+    SDL_AtomicSet(&audio_pending, 0);
+  }
+}
+
+int voice_group_add(const char *name, int count, int priority, int stealable)
+{
+  struct voice_group *group;
+  
+  if(voice_groups_size == VOICE_GROUPS_MAX || voices + count > VOICES_MAX)
+  {
+    printf("Unable to add %d voices for %s\n", count, name);
+    exit(-1);
+  }
+  
+  // Channels after the ones already given out, tagged with the group id
+  group = &voice_groups[voice_groups_size];
+  group->name = name;
+  group->first = voices;
+  group->count = count;
+  group->priority = priority;
+  group->stealable = stealable;
+  voices += count;
+  Mix_AllocateChannels(voices);
+  Mix_GroupChannels(group->first, group->first + count - 1, voice_groups_size);
+  return voice_groups_size++;
+}
+
+int voice_steal(int priority)
+{
+  int i, lowest, oldest, channel;
+  
+  // Oldest voice of the lowest priority group that gives them up
+  lowest = -1;
+  channel = -1;
+  for(i=0; i<voice_groups_size; i++)
+  {
+    if(voice_groups[i].stealable && voice_groups[i].priority <= priority
+       && (lowest < 0 || voice_groups[i].priority < voice_groups[lowest].priority))
+    {
+      oldest = Mix_GroupOldest(i);
+      if(oldest >= 0)
+      {
+	lowest = i;
+	channel = oldest;
+      }
+    }
+  }
+  if(channel >= 0)
+  {
+    Mix_HaltChannel(channel);
+  }
+  return channel;
+}
+
+void audio_report()
+{
+  struct histogram *h;
+  struct voice_group *group;
+  int i;
+  
+  printf("Audio: %dHz, %d samples buffer (%.1fms), longest callback gap %.1fms\n", audio_rate, audio_buffer_opened,
+	 audio_buffer_opened*1000.0/audio_rate, audio_max_gap*1000.0/SDL_GetPerformanceFrequency());
+  h = &audio_latency;
+  if(h->count > 0)
+  {
+    printf("Play to output: %llu plays, min %.1fms, mean %.1fms, p50 %.1fms, p95 %.1fms, p99 %.1fms, max %.1fms\n",
+	   (unsigned long long)h->count, h->min_us/1000.0, (double)h->sum_us/h->count/1000.0,
+	   histogram_percentile(h, 50)/1000.0, histogram_percentile(h, 95)/1000.0,
+	   histogram_percentile(h, 99)/1000.0, h->max_us/1000.0);
+  }
+  for(i=0; i<voice_groups_size; i++)
+  {
+    group = &voice_groups[i];
+    printf("Voices %-8s %2d voices, %u played, %u stolen, %u dropped\n", group->name, group->count,
+	   group->played, group->stolen, group->dropped);
+  }
+}
+#endif
+
+#ifndef HEADLESS
+void init_input()
+{
+  // Replays take buttons from the log, nothing to poll
+  if(!input_threaded || replay_path != NULL) return;
+  
+  // Only the input thread updates the controllers, SDL_PumpEvents
+  // leaves them alone and no joystick events are queued
+  SDL_SetHint(SDL_HINT_AUTO_UPDATE_JOYSTICKS, "0");
+  SDL_JoystickEventState(SDL_IGNORE);
+  input_stop = SDL_CreateSemaphore(0);
+  input_thread = SDL_CreateThread(input_worker, "input", NULL);
+  if(input_stop == NULL || input_thread == NULL)
+  {
+    printf( "Unable to start input thread! SDL Error: %s\n", SDL_GetError() );
+    exit(-1);
+  }
+}
+
+void close_input()
+{
+  if(input_thread != NULL)
+  {
+    SDL_SemPost(input_stop);
+    SDL_WaitThread(input_thread, NULL);
+    input_thread = NULL;
+  }
+  if(input_stop != NULL)
+  {
+    SDL_DestroySemaphore(input_stop);
+    input_stop = NULL;
+  }
+}
+
+int input_worker(void *data)
+{
+  Uint8 buttons[MAX_CONTROLLERS][INPUT_BUTTONS];
+  Sint16 axes[MAX_CONTROLLERS][INPUT_AXES];
+  Uint64 now;
+  Uint8 button;
+  Sint16 axis;
+  int i, j, count;
+  
+  memset(buttons, 0, sizeof(buttons));
+  memset(axes, 0, sizeof(axes));
+  do
+  {
+    // Read the controllers and stamp every change with the same time
+    SDL_JoystickUpdate();
+    now = SDL_GetPerformanceCounter();
+    for(i=0; i<MAX_CONTROLLERS; i++)
+    {
+      if(sdl_gamepads[i] == NULL) continue;
+      count = SDL_JoystickNumButtons(sdl_gamepads[i]);
+      for(j=0; j<count && j<INPUT_BUTTONS; j++)
+      {
+	button = SDL_JoystickGetButton(sdl_gamepads[i], j);
+	if(button != buttons[i][j])
+	{
+	  buttons[i][j] = button;
+	  input_push(button ? INPUT_BUTTON_DOWN : INPUT_BUTTON_UP, i, j, 0, now);
+	}
+      }
+      count = SDL_JoystickNumAxes(sdl_gamepads[i]);
+      for(j=0; j<count && j<INPUT_AXES; j++)
+      {
+	axis = SDL_JoystickGetAxis(sdl_gamepads[i], j);
+	if(axis != axes[i][j])
+	{
+	  axes[i][j] = axis;
+	  input_push(INPUT_AXIS, i, j, axis, now);
+	}
+      }
+    }
+  }
+  while(SDL_SemWaitTimeout(input_stop, input_interval) == SDL_MUTEX_TIMEDOUT);
+  return 0;
+}
+#endif
+
+void input_push(int type, int controller, int index, int value, Uint64 counter)
+{
+  struct input_event *event;
+  int head;
+  
+  head = SDL_AtomicGet(&input_head);
+  if(head - SDL_AtomicGet(&input_tail) == INPUT_QUEUE_SIZE)
+  {
+    printf("Input queue full, event dropped\n");
+    return;
+  }
+  event = &input_queue[(unsigned int)head % INPUT_QUEUE_SIZE];
+  event->type = type;
+  event->controller = controller;
+  event->index = index;
+  event->value = value;
+  event->counter = counter;
+  // Event written before the simulation can see it
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&input_head, head+1);
+}
+
+void input_drain(Uint64 tick_start, Uint64 tick_end)
+{
+  struct input_event *event;
+  Uint64 tick_period;
+  int tail;
+  
+  // Inputs read before the end of the tick, in the order they happened
+  tick_period = tick_end - tick_start;
+  tail = SDL_AtomicGet(&input_tail);
+  while(tail != SDL_AtomicGet(&input_head))
+  {
+    SDL_MemoryBarrierAcquire();
+    event = &input_queue[(unsigned int)tail % INPUT_QUEUE_SIZE];
+    if(event->counter >= tick_end && tick_period > 0) break;
+    
+    // Late ones, from dropped time or a stopped game, go at the start
+    input_phase = 0;
+    if(event->counter > tick_start && tick_period > 0)
+    {
+      input_phase = (event->counter - tick_start) * INPUT_PHASES / tick_period;
+    }
+    if(event->type == INPUT_AXIS)
+    {
+      process_axis(event->controller, event->index, event->value);
+    }
+    else
+    {
+      process_button(event->controller, event->index, event->type == INPUT_BUTTON_DOWN);
+      if(event->type == INPUT_BUTTON_DOWN && event->counter > input_applied)
+      {
+	input_applied = event->counter;
+      }
+    }
+    input_phase = 0;
+    
+    // Slot read before it is handed back
+    tail++;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&input_tail, tail);
+  }
+}
+
+void latency_print()
+{
+  struct histogram *h;
+  
+  h = &profile[PHASE_INPUT_LATENCY];
+  if(h->count == 0)
+  {
+    printf("Input to present: no presses measured\n");
+    return;
+  }
+  printf("Input to present: %llu presses, min %.1fms, mean %.1fms, p50 %.1fms, p95 %.1fms, p99 %.1fms, max %.1fms\n",
+	 (unsigned long long)h->count, h->min_us/1000.0, (double)h->sum_us/h->count/1000.0,
+	 histogram_percentile(h, 50)/1000.0, histogram_percentile(h, 95)/1000.0,
+	 histogram_percentile(h, 99)/1000.0, h->max_us/1000.0);
+}
+
+void process_input(SDL_Event *e)
+{
+  //User requests quit
+  if(e->type == SDL_QUIT 
+    // User press ESC or q
+    || (e->type == SDL_KEYDOWN && (e->key.keysym.sym=='q' || e->key.keysym.sym == 27))
+  )
+  {
+    quit = 1;
+  }
+  // Cached layers are gone, they are drawn again on next frame
+  else if(e->type == SDL_RENDER_TARGETS_RESET || e->type == SDL_RENDER_DEVICE_RESET)
+  {
+    render_targets_reset++;
+  }
+  // User press p, dump profile
+  else if(e->type == SDL_KEYDOWN && e->key.keysym.sym=='p')
+  {
+    profile_dump();
+  }
+  // Controllers, when the input thread is not polling them
+  // Axis 0 controls player velocity
+  else if(e->type == SDL_JOYAXISMOTION)
+  {
+    //printf("controller: %d, axis: %d, value: %d\n", e->jaxis.which, e->jaxis.axis, e->jaxis.value);
+    input_push(INPUT_AXIS, e->jaxis.which, e->jaxis.axis, e->jaxis.value, SDL_GetPerformanceCounter());
+  }
+  // Buttons, replays take them from the log instead
+  else if((e->type == SDL_JOYBUTTONDOWN || e->type == SDL_JOYBUTTONUP) && replay_path == NULL)
+  {
+    input_push(e->type == SDL_JOYBUTTONDOWN ? INPUT_BUTTON_DOWN : INPUT_BUTTON_UP, e->jbutton.which, e->jbutton.button, 0, SDL_GetPerformanceCounter());
+  }
+}
+
+void process_button(int controller, int button, int down)
+{
+  if(record_file != NULL)
+  {
+    record_event(controller, button, down ? REPLAY_BUTTON_DOWN : REPLAY_BUTTON_UP);
+  }
+  
+  // Buttons down
+  if(down) 
+  {
+    if(button == BUTTON_SELECT)
+    {
+      select_button=1;
+    }
+    if(button == BUTTON_START)
+    {
+      start_button=1;
+    }
+    if(button != BUTTON_SELECT && button != BUTTON_START)
+    {
+      process_button_down(controller, button);
+    }
+  }
+  // Buttons up
+  else
+  {
+    if(button == BUTTON_SELECT)
+    {
+      select_button=0;
+    }
+    if(button == BUTTON_START)
+    {
+      start_button=0;
+    }
+    if(button != BUTTON_SELECT && button != BUTTON_START)
+    {
+      process_button_up(controller, button);
+    }
+  }
+  if(start_button && select_button)
+  {
+    quit=1;
+  }
+  if(players_menu && select_button)
+  {
+    players++;
+    if(players>players_max)
+    {
+      players=1;
+    }
+  }
+  if(players_menu && start_button)
+  {
+    // Init game data
+    init_game();
+    // Close menu
+    players_menu=0;
+  }
+  if(game_over && start_button)
+  {
+    game_over=0;
+    players_menu=1;
+  }
+}
+
+void record_open(char *path)
+{
+  struct replay_header header;
+  
+  record_file=fopen(path, "wb");
+  if(record_file == NULL)
+  {
+    printf("Unable to create input log %s\n", path);
+    exit(-1);
+  }
+  header.magic=REPLAY_MAGIC;
+  header.version=REPLAY_VERSION;
+  header.seed=seed;
+  header.sim_rate=sim_rate;
+  header.players_max=players_max;
+  memset(header.options, 0, sizeof(header.options));
+  save_game_options(header.options);
+  fwrite(&header, sizeof(struct replay_header), 1, record_file);
+}
+
+void record_event(int controller, int button, int type)
+{
+  struct replay_event event;
+  
+  event.frame=frames;
+  event.controller=controller;
+  event.button=button;
+  event.type=type;
+  event.phase=input_phase;
+  fwrite(&event, sizeof(struct replay_event), 1, record_file);
+}
+
+void record_close()
+{
+  Uint32 checksum;
+  
+  // End of session and the state it should leave behind
+  record_event(0, 0, REPLAY_END);
+  checksum=state_checksum();
+  fwrite(&checksum, sizeof(Uint32), 1, record_file);
+  if(fclose(record_file) != 0)
+  {
+    printf("Unable to write input log %s\n", record_path);
+  }
+  record_file=NULL;
+}
+
+void replay_load(char *path)
+{
+  struct replay_header header;
+  struct replay_event event;
+  FILE *file;
+  Uint32 checksum;
+  int capacity;
+  
+  file=fopen(path, "rb");
+  if(file == NULL)
+  {
+    printf("Unable to open input log %s\n", path);
+    exit(-1);
+  }
+  if(fread(&header, sizeof(struct replay_header), 1, file) != 1
+     || header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION)
+  {
+    printf("%s is not an input log\n", path);
+    exit(-1);
+  }
+  
+  // Whole log in memory, up to and including the end event
+  capacity=0;
+  replay_size=0;
+  do
+  {
+    if(fread(&event, sizeof(struct replay_event), 1, file) != 1)
+    {
+      printf("Input log %s is truncated\n", path);
+      exit(-1);
+    }
+    if(replay_size == capacity)
+    {
+      capacity = capacity ? capacity*2 : 256;
+      replay_events = realloc(replay_events, capacity*sizeof(struct replay_event));
+    }
+    replay_events[replay_size++]=event;
+  }
+  while(event.type != REPLAY_END);
+  if(fread(&checksum, sizeof(Uint32), 1, file) != 1)
+  {
+    printf("Input log %s is truncated\n", path);
+    exit(-1);
+  }
+  fclose(file);
+  
+  // Replays run at the recorded rate with the recorded seed and
+  // settings, whatever the command line says
+  if(header.players_max < 2 || header.players_max > MAX_PLAYERS)
+  {
+    printf("Input log %s is for %u players, at most %d are supported\n", path, header.players_max, MAX_PLAYERS);
+    exit(-1);
+  }
+  seed=header.seed;
+  sim_rate=header.sim_rate;
+  players_max=header.players_max;
+  load_game_options(header.options);
+  replay_checksum=checksum;
+  replay_next=0;
+}
+
+void replay_input()
+{
+  struct replay_event *event;
+  
+  // Feed every event processed before this tick
+  while(replay_next < replay_size && replay_events[replay_next].frame <= frames)
+  {
+    event=&replay_events[replay_next];
+    if(event->type == REPLAY_END)
+    {
+      quit=1;
+      return;
+    }
+    input_phase=event->phase;
+    process_button(event->controller, event->button, event->type == REPLAY_BUTTON_DOWN);
+    input_phase=0;
+    replay_next++;
+  }
+}
+
+int replay_report()
+{
+  unsigned int checksum;
+  double seconds;
+  
+  // Timings and final state, to compare builds
+  seconds=(double)(SDL_GetPerformanceCounter()-replay_counter)/perf_frequency;
+  checksum=state_checksum();
+  printf("{\"replay\": \"%s\", \"fast\": %d, \"ticks\": %u, \"frames\": %u, \"seconds\": %.3f, "
+	 "\"ticks_per_second\": %.1f, \"frames_per_second\": %.1f, \"checksum\": %u, \"expected_checksum\": %u, \"match\": %s, \"update\": ",
+	 replay_path, replay_fast, frames, render_frames, seconds, frames/seconds, render_frames/seconds,
+	 checksum, replay_checksum, checksum == replay_checksum ? "true" : "false");
+  histogram_write_json(stdout, &profile[PHASE_UPDATE]);
+  printf(", \"draw\": ");
+  histogram_write_json(stdout, &profile[PHASE_DRAW]);
+  printf("}\n");
+  return checksum == replay_checksum;
+}
+
+#ifndef HEADLESS
+void render_menu()
+{
+  static const char *names[MAX_PLAYERS] = {"1 Player", "2 Players", "3 Players", "4 Players",
+					   "5 Players", "6 Players", "7 Players", "8 Players"};
+  SDL_Rect sdl_rect;
+  struct sized_texture *texture_text;
+  TTF_Font *font;
+  int i, spacing;
+  
+  //Clear screen
+  SDL_SetRenderDrawColor( sdl_renderer, 0x00, 0x00, 0x00, 0xFF );
+  SDL_RenderClear( sdl_renderer );
+  
+  // Longer lists use the small font, packed and centered
+  font = players_max > 2 ? font_small : font_medium;
+  texture_text=get_static_text(font, names[0], view->players==1 ? color_white : color_grey);
+  sdl_rect.x=SCREEN_WIDTH/2-texture_text->width/2;
+  if(players_max > 2)
+  {
+    spacing=texture_text->height;
+    sdl_rect.y=(SCREEN_HEIGHT-players_max*spacing)/2;
+  }
+  else
+  {
+    spacing=100;
+    sdl_rect.y=SCREEN_HEIGHT-100-texture_text->height-texture_text->height;
+    sdl_rect.y/=2;
+  }
+  
+  for(i=0; i<players_max; i++)
+  {
+    texture_text=get_static_text(font, names[i], view->players==i+1 ? color_white : color_grey);
+    sdl_rect.w=texture_text->width;
+    sdl_rect.h=texture_text->height;  
+    SDL_RenderCopy(sdl_renderer, texture_text->texture, NULL, &sdl_rect);
+    sdl_rect.y+=spacing;
+  }
+}
+#endif
+
+void arena_init(struct arena *arena, size_t size)
+{
+  arena_free(arena);
+  // Aligned for the vector kernels, allocations keep the alignment
+  arena->base = SDL_SIMDAlloc(size);
+  if(arena->base == NULL)
+  {
+    printf( "Unable to allocate a %lu bytes arena!\n", (unsigned long)size );
+    exit(-1);
+  }
+  arena->size = size;
+  arena->used = 0;
+}
+
+void* arena_alloc(struct arena *arena, size_t size)
+{
+  void *data;
+  
+  // NULL when it does not fit, used still grows so callers can resize
+  size = (size + ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1);
+  data = arena->used + size <= arena->size ? arena->base + arena->used : NULL;
+  arena->used += size;
+  return data;
+}
+
+void arena_reset(struct arena *arena)
+{
+  arena->used = 0;
+}
+
+void arena_free(struct arena *arena)
+{
+  SDL_SIMDFree(arena->base);
+  arena->base = NULL;
+  arena->size = 0;
+  arena->used = 0;
+}
+
+#ifndef HEADLESS
+void read_temp()
+{
+  // Latest telemetry, no file I/O on the render thread
+  telemetry_snapshot(&telemetry);
+  if(telemetry.zones > 0)
+  {
+    temperature = telemetry.temperature;
+  }
+}
+
+void init_telemetry()
+{
+  char path[96];
+  int i;
+  
+  // Open every source once, the thread only reads them again
+  for(i=0; i<TELEMETRY_ZONES; i++)
+  {
+    snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp", i);
+    telemetry_zone_files[i] = open(path, O_RDONLY);
+  }
+  for(i=0; i<TELEMETRY_CPUS; i++)
+  {
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", i);
+    telemetry_cpu_files[i] = open(path, O_RDONLY);
+  }
+  // Raspberry Pi firmware, under-voltage and throttling bits
+  telemetry_throttled_file = open("/sys/devices/platform/soc/soc:firmware/get_throttled", O_RDONLY);
+  
+  SDL_AtomicSet(&telemetry_sequence, 0);
+  telemetry_stop = SDL_CreateSemaphore(0);
+  telemetry_thread = SDL_CreateThread(telemetry_worker, "telemetry", NULL);
+  if(telemetry_stop == NULL || telemetry_thread == NULL)
+  {
+    printf( "Unable to start telemetry thread! SDL Error: %s\n", SDL_GetError() );
+    exit(-1);
+  }
+}
+
+void close_telemetry()
+{
+  int i;
+  
+  if(telemetry_thread == NULL) return;
+  SDL_SemPost(telemetry_stop);
+  SDL_WaitThread(telemetry_thread, NULL);
+  SDL_DestroySemaphore(telemetry_stop);
+  telemetry_thread = NULL;
+  telemetry_stop = NULL;
+  for(i=0; i<TELEMETRY_ZONES; i++)
+  {
+    if(telemetry_zone_files[i] >= 0) close(telemetry_zone_files[i]);
+  }
+  for(i=0; i<TELEMETRY_CPUS; i++)
+  {
+    if(telemetry_cpu_files[i] >= 0) close(telemetry_cpu_files[i]);
+  }
+  if(telemetry_throttled_file >= 0) close(telemetry_throttled_file);
+  telemetry_throttled_file = -1;
+}
+
+int telemetry_worker(void *data)
+{
+  struct telemetry sample;
+  long value;
+  int i;
+  
+  memset(&sample, 0, sizeof(struct telemetry));
+  do
+  {
+    // Zones that exist, in order, and the hottest
+    sample.zones = 0;
+    sample.temperature = 0;
+    for(i=0; i<TELEMETRY_ZONES; i++)
+    {
+      value = telemetry_read_file(telemetry_zone_files[i], 10);
+      if(value < 0) continue;
+      sample.zone_temperature[sample.zones] = value / 1000.0;
+      if(sample.zone_temperature[sample.zones] > sample.temperature)
+      {
+	sample.temperature = sample.zone_temperature[sample.zones];
+      }
+      sample.zones++;
+    }
+    sample.cpus = 0;
+    for(i=0; i<TELEMETRY_CPUS; i++)
+    {
+      value = telemetry_read_file(telemetry_cpu_files[i], 10);
+      if(value < 0) continue;
+      sample.cpu_khz[sample.cpus++] = value;
+    }
+    sample.throttled = telemetry_read_file(telemetry_throttled_file, 16);
+    sample.samples++;
+    telemetry_publish(&sample);
+  }
+  // Sleep until the next sample, or until asked to stop
+  while(SDL_SemWaitTimeout(telemetry_stop, telemetry_interval) == SDL_MUTEX_TIMEDOUT);
+  return 0;
+}
+
+long telemetry_read_file(int fd, int base)
+{
+  char text[32];
+  ssize_t size;
+  
+  // sysfs regenerates the value on every read from offset 0
+  if(fd < 0) return -1;
+  size = pread(fd, text, sizeof(text)-1, 0);
+  if(size <= 0) return -1;
+  text[size] = '\0';
+  return strtol(text, NULL, base);
+}
+
+void telemetry_publish(struct telemetry *sample)
+{
+  // Single writer: odd sequence while copying, readers retry meanwhile
+  SDL_AtomicAdd(&telemetry_sequence, 1);
+  SDL_MemoryBarrierRelease();
+  telemetry_shared = *sample;
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicAdd(&telemetry_sequence, 1);
+}
+
+void telemetry_snapshot(struct telemetry *sample)
+{
+  int before, after;
+  
+  // Never blocks the writer, retries only if a publish was in flight
+  do
+  {
+    before = SDL_AtomicGet(&telemetry_sequence);
+    SDL_MemoryBarrierAcquire();
+    *sample = telemetry_shared;
+    SDL_MemoryBarrierAcquire();
+    after = SDL_AtomicGet(&telemetry_sequence);
+  }
+  while((before & 1) || before != after);
+}
+
+int frame_rate()
+{
+  int rate;
+  
+  // Configured rate scaled by the governor level
+  rate = render_rate * governor_levels[governor_level].rate / 100;
+  return rate > 0 ? rate : 1;
+}
+
+void governor_frame(Uint64 busy, Uint64 frame_period)
+{
+  governor_frames++;
+  governor_busy += busy;
+  if(frame_period > 0 && busy > frame_period)
+  {
+    governor_over++;
+  }
+}
+
+void governor_update()
+{
+  Uint64 now;
+  double seconds, slope, over;
+  int levels;
+  
+  now = SDL_GetPerformanceCounter();
+  levels = sizeof(governor_levels)/sizeof(governor_levels[0]);
+  
+  // Trend from the previous sample, smoothed so one noisy read does not count
+  if(governor_last_counter > 0 && temperature > 0)
+  {
+    seconds = (double)(now - governor_last_counter) / perf_frequency;
+    slope = (temperature - governor_last_temperature) / seconds;
+    temperature_trend = 0.7*temperature_trend + 0.3*slope;
+  }
+  governor_last_temperature = temperature;
+  governor_last_counter = now;
+  over = governor_frames > 0 ? (double)governor_over / governor_frames : 0;
+  governor_held++;
+  
+  // Step down when hot, warm and heating, or missing the frame budget
+  if(governor_level < levels-1 && governor_held >= GOVERNOR_DOWN_HOLD)
+  {
+    if(temperature >= governor_hot)
+    {
+      governor_set_level(governor_level+1, "hot", over);
+    }
+    else if(temperature >= governor_cool && temperature_trend > governor_rising)
+    {
+      governor_set_level(governor_level+1, "heating", over);
+    }
+    else if(over > governor_over_down)
+    {
+      governor_set_level(governor_level+1, "over budget", over);
+    }
+  }
+  
+  // Step up once cool, not heating and well within budget for a while
+  if(governor_level > 0 && governor_held >= governor_up_hold
+     && temperature < governor_cool && temperature_trend <= 0 && over < governor_over_up)
+  {
+    governor_set_level(governor_level-1, "cool", over);
+  }
+  
+  governor_frames = 0;
+  governor_over = 0;
+  governor_busy = 0;
+}
+
+void governor_set_level(int level, const char *reason, double over)
+{
+  double busy_ms;
+  
+  // Stepping down again right after stepping up, wait longer next time
+  if(level > governor_level && governor_last_up && governor_held <= GOVERNOR_DOWN_HOLD)
+  {
+    governor_up_hold = governor_up_hold*2 < GOVERNOR_UP_HOLD_MAX ? governor_up_hold*2 : GOVERNOR_UP_HOLD_MAX;
+  }
+  governor_last_up = level < governor_level;
+  
+  // Every decision with its inputs, to tune thresholds per board
+  busy_ms = governor_frames > 0 ? (double)governor_busy * 1000 / perf_frequency / governor_frames : 0;
+  printf("Governor: %s -> %s (%s, %.1fC, %+.3fC/s, %.2fms busy, %.0f%% over budget)\n",
+	 governor_levels[governor_level].name, governor_levels[level].name, reason,
+	 temperature, temperature_trend, busy_ms, over*100);
+  if(governor_log != NULL)
+  {
+    fprintf(governor_log, "%.3f,%.1f,%.4f,%.3f,%.3f,%d,%d,%s\n",
+	    (double)(SDL_GetPerformanceCounter() - startup_counter) / perf_frequency,
+	    temperature, temperature_trend, busy_ms, over, governor_level, level, reason);
+    fflush(governor_log);
+  }
+  
+  governor_level = level;
+  governor_held = 0;
+  render_scale = governor_levels[level].scale;
+  render_effects = governor_levels[level].effects;
+}
+#endif
+
+#ifndef HEADLESS
+int main( int argc, char* args[] )
+{
+  //Event handler
+  SDL_Event e;
+  // Events phase start
+  Uint64 start;
+  
+  //Replay result
+  int replay_match;
+  // Benchmark measures slower than the baseline
+  int regressions;
+  
+  // Init quit flag
+  quit=0;
+  startup_counter = SDL_GetPerformanceCounter();
+  
+  // Read command line options
+  parse_args(argc, args);
+  
+  // Initialize random seed, replays reuse the recorded one
+  seed=time(NULL);
+  if(replay_path != NULL)
+  {
+    replay_load(replay_path);
+  }
+  srand(seed);
+  if(record_path != NULL)
+  {
+    record_open(record_path);
+  }
+  
+  // Start up SDL and create window
+  init();
+  
+  // Decode fonts and media on the loader workers
+  load_media();
+  load_assets();
+  
+  // Upload to the GPU on this thread
+  start = SDL_GetPerformanceCounter();
+  upload_media();
+  startup_add("upload media", 0, start, SDL_GetPerformanceCounter());
+  
+  // Build glyph atlases and static text cache
+  start = SDL_GetPerformanceCounter();
+  init_text();
+  startup_add("glyph atlases", 0, start, SDL_GetPerformanceCounter());
+  
+  // Start simulation clock
+  init_timing();
+  init_profile();
+  replay_counter = SDL_GetPerformanceCounter();
+  
+  // Governor decisions log, CSV
+  if(governor_log_path != NULL)
+  {
+    governor_log = fopen(governor_log_path, "w");
+    if(governor_log == NULL)
+    {
+      printf("Unable to create governor log %s\n", governor_log_path);
+      exit(-1);
+    }
+    fprintf(governor_log, "seconds,temperature,trend,busy_ms,over_budget,from_level,to_level,reason\n");
+  }
+  
+  // Benchmark scenarios instead of the game, ticks and frames in turn
+  if(bench_path != NULL)
+  {
+    if(frame_hash_path != NULL)
+    {
+      frame_hash_file = fopen(frame_hash_path, "w");
+      if(frame_hash_file == NULL)
+      {
+	printf("Unable to create frame hashes %s\n", frame_hash_path);
+	exit(-1);
+      }
+      show_overlay=0;
+    }
+    sim_threaded=0;
+    init_sim();
+    run_bench();
+    bench_write(bench_path);
+    if(frame_hash_file != NULL)
+    {
+      fclose(frame_hash_file);
+      printf("Frame hashes written to %s\n", frame_hash_path);
+    }
+    regressions = bench_baseline_path != NULL ? bench_check(bench_baseline_path) : 0;
+    close_sim();
+    close_sdl();
+    return regressions > 0 ? 1 : 0;
+  }
+  
+  // Simulation runs on its own thread from here, fed by the input thread
+  init_sim();
+  init_input();
+  
+  // Main game loop
+  while(!quit)
+  {
+    //Handle events on queue
+    start = SDL_GetPerformanceCounter();
+    while( SDL_PollEvent( &e ) != 0 )
+    {
+      process_input(&e);
+    }
+    profile_add(PHASE_EVENTS, start, SDL_GetPerformanceCounter());
+    // Without the simulation thread, ticks run between frames
+    if(!sim_threaded)
+    {
+      sim_step();
+    }
+    // Render
+    sync_render();
+  }
+  
+  // Final state is read once the simulation has stopped
+  close_input();
+  close_sim();
+  
+  // Close input log, or check the replay ended in the recorded state
+  replay_match=1;
+  if(record_file != NULL)
+  {
+    record_close();
+  }
+  if(replay_path != NULL)
+  {
+    replay_match=replay_report();
+    free(replay_events);
+  }
+  
+  // Write frame time histograms
+  profile_dump();
+  if(latency_report)
+  {
+    latency_print();
+  }
+  
+  if(governor_log != NULL)
+  {
+    fclose(governor_log);
+  }
+  close_sdl();
+  return replay_match ? 0 : 1;
+}
+#endif
+
+//-----------------------------------------------------------------------------------------
+
+
+#define MAGAZINE_SIZE 4
+#define BULLETS_SIZE 100
+// Ducks each player gets, flocks fly in waves of FLOCK_WAVE
+#define FLOCK_SIZE 10
+#define FLOCK_WAVE 10
+#define DUCK_WIDTH 40
+#define DUCK_HEIGHT 30
+// Positions and speeds are fixed point, FIXED_SHIFT bits of sub-pixel.
+// Integer only, a tick gives the same result on every machine
+#define FIXED_SHIFT 8
+#define FIXED_ONE (1<<FIXED_SHIFT)
+#define TO_FIXED(v) ((v)*FIXED_ONE)
+#define FROM_FIXED(v) ((v)>>FIXED_SHIFT)
+// Shot angle, cos and sin of 35 degrees with 16 fraction bits
+#define BULLET_COS 53684
+#define BULLET_SIN 37590
+// Speeds in pixels per base tick
+#define SPEED_BULLET 30
+#define DUCK_SPEED 3
+#define DUCK_FALL_SPEED 10
+#define DUCK_START_X 0
+// Path tables hold a height per base tick, a flight repeats after
+// PATH_LAP of them. Ducks fly straight from one to the next, so ticks of
+// any length sweep them along the same lines
+#define PATH_LAP 256
+// Fraction bits of a duck phase, which counts samples
+#define PATH_PHASE_SHIFT 16
+// Height of the HUD strip at the bottom of the screen
+#define HUD_HEIGHT 64
+// Width of a player entry in the HUD: shells, duck counter and score.
+// Narrower slots get the compact entry, without the counter
+#define HUD_ENTRY_WIDTH 200
+
+// Sprites in the image atlas, in the order they are added
+enum sprite_id
+{
+  SPRITE_HUNTER,
+  SPRITE_BULLET,
+  SPRITE_DUCK_FLY,
+  SPRITE_DUCK_FLY_2,
+  SPRITE_DUCK_FLY_3,
+  SPRITE_DUCK_SHOT,
+  SPRITE_DUCK_FALL,
+  SPRITE_COUNT
+};
+
+// Duck paths, baked into tables when a round starts
+enum path_id
+{
+  PATH_STRAIGHT,
+  PATH_SINE,
+  PATH_DIVE,
+  PATH_SPLINE,
+  // Shot ducks hang in the air, then drop
+  PATH_FALL,
+  PATH_COUNT
+};
+// Paths flying ducks are given
+#define PATH_FLIGHTS PATH_FALL
+
+
+// Bullets, one aligned array per field. Live bullets are packed in
+// [0, count), the slots after them are free, despawn swaps in the last one
+struct bullet_pool
+{
+  int count;
+  int capacity;
+  // Owner of the fields, NULL when they are on the heap
+  struct arena *arena;
+  // Hot fields, updated by the entity kernels
+  int *x;
+  int *y;
+  int *vx;
+  int *vy;
+  // Cleared by culling, live bullets are always enabled
+  int *enabled;
+  // Position at previous tick, for interpolation
+  int *prev_x;
+  int *prev_y;
+  int *player;
+  // Base tick of the tick it was fired in, collisions skip the ones
+  // before. 0 from the next tick on
+  int *fire_chord;
+};
+
+// Ducks, one aligned array per field
+struct duck_pool
+{
+  // Ducks in use
+  int size;
+  int capacity;
+  // Owner of the fields, NULL when they are on the heap
+  struct arena *arena;
+  // Hot fields, updated by the entity kernels
+  int *x;
+  int *y;
+  int *vx;
+  int *vy;
+  int *enabled;
+  // Path followed, time reached in it and height it is flown from
+  int *path;
+  int *phase;
+  int *offset;
+  // Position at previous tick, for interpolation
+  int *prev_x;
+  int *prev_y;
+  unsigned int *shoot_time;
+};
+
+// Heights of every path, sampled at a fixed rate whatever the tick rate.
+// A duck is at its offset plus the height at its phase, interpolated
+// between the two samples around it
+struct path_table
+{
+  // Duck and screen height the table was baked for
+  int height;
+  int screen_height;
+  // Phase a simulation tick adds, and base ticks it spans. Collisions
+  // sweep a duck along the path one base tick at a time
+  int step;
+  int chords;
+  // Samples of every path, one after the other, fixed point. Each path
+  // has two more, so the one after the last can always be read
+  int *y;
+  int y_capacity;
+  // First sample and samples of each path. Past its end a path loops
+  // or stays on its last sample
+  int start[PATH_COUNT];
+  int length[PATH_COUNT];
+  int loop[PATH_COUNT];
+};
+
+// Entity update kernels for one instruction set
+struct entity_kernels
+{
+  const char *name;
+  // Add velocity to position, only where enabled unless it is NULL
+  void (*integrate)(int *x, int *y, const int *vx, const int *vy, const int *enabled, int n);
+  // Disable ducks that left the screen, stop the ones below it
+  void (*cull_ducks)(const int *x, const int *y, int *vx, int *vy, int *enabled, int n, int width, int height);
+  // Disable bullets that left the screen
+  void (*cull_bullets)(const int *x, const int *y, int *enabled, int n, int width, int height);
+  // Positions of the points in the rectangle, bounds included, are
+  // stored in found. Returns how many
+  int (*in_rect)(const int *x, const int *y, int n, int x0, int y0, int x1, int y1, int *found);
+  // Advance every duck on its path by a tick. Vertical speed takes it to
+  // the path height there, 0 where not enabled
+  void (*follow_paths)(const struct path_table *paths, const int *path, int *phase, const int *offset, const int *y, int *vy, const int *enabled, int n);
+};
+
+struct shot_gun
+{
+  int magazine;
+  // Tick the reload ends in and its position in it, see input_phase
+  unsigned int cocking_time;
+  int cocking_phase;
+};
+
+struct hunter
+{
+  int x,y,score;
+};
+
+// Game part of a snapshot: only what render() draws
+struct game_snapshot
+{
+  struct hunter hunters[MAX_PLAYERS];
+  int magazine[MAX_PLAYERS];
+  // Pools grow with the live ones, velocities pick the duck sprite
+  struct duck_pool ducks;
+  struct bullet_pool bullets;
+};
+
+// Uniform grid of ducks used as collision broadphase
+struct duck_grid
+{
+  int cell_size;
+  int columns;
+  int rows;
+  // Area bullets can reach during a tick
+  int min_x, min_y, max_x, max_y;
+  // Most a duck moved on either axis this tick
+  int reach;
+  // First entry of each cell in cell_ducks, plus an end marker
+  int *cell_start;
+  // Duck indexes sorted by cell, with their positions
+  int *cell_ducks;
+  int *cell_x;
+  int *cell_y;
+  // Cell of each duck, -1 when not in the grid
+  int *duck_cell;
+  // Ducks of a query that passed the broadphase
+  int *candidates;
+  // Earliest hit of each duck in a round of a collision pass, den 0
+  // when none, the bullet that made it and the ducks hit
+  Sint64 *hit_num;
+  Sint64 *hit_den;
+  int *hit_bullet;
+  int *hit_ducks;
+  int hits;
+  // When ducks were shot during the pass, den 0 when not, and which
+  Sint64 *shot_num;
+  Sint64 *shot_den;
+  int *shot_ducks;
+  int shots;
+  int cells_capacity;
+  int ducks_capacity;
+};
+
+// Benchmark scenario: ducks per player, ticks between autoplay shots, 0
+// to empty every magazine each tick, whether the flock is scattered over
+// the screen instead of flying in, and whether only the menu is drawn
+struct bench_scenario
+{
+  const char *name;
+  int players;
+  int flock;
+  int fire_interval;
+  int scatter;
+  int menu;
+};
+
+void init_ball();
+void fire(int);
+void cock(int);
+void process_start_button();
+void process_select_button();
+int* alloc_field(int capacity, struct arena *arena);
+void alloc_round();
+void duck_pool_alloc(struct duck_pool *pool, int capacity, struct arena *arena);
+void duck_pool_free(struct duck_pool *pool);
+void bullet_pool_alloc(struct bullet_pool *pool, int capacity, struct arena *arena);
+void bullet_pool_free(struct bullet_pool *pool);
+int bullet_spawn(struct bullet_pool *pool);
+void bullet_despawn(struct bullet_pool *pool, int i);
+void bullet_remove_disabled(struct bullet_pool *pool);
+void init_kernels(char *name);
+void paths_bake();
+int path_height(int path, int sample);
+int path_y(int path, int phase);
+void grid_build(struct duck_pool *ducks);
+int grid_cell(int x, int y);
+int grid_find_duck(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den);
+int sweep_box(int sx, int sy, int dx, int dy, int width, int height, Sint64 *num, Sint64 *den);
+void duck_corner(struct duck_pool *ducks, int j, int c, int *x, int *y);
+int sweep_duck(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int j, int c, Sint64 *num, Sint64 *den);
+void duck_hit(int j, int i, Sint64 num, Sint64 den);
+void duck_shoot(struct duck_pool *ducks, int j, Sint64 num, Sint64 den);
+int collide_round(struct bullet_pool *bullets, struct duck_pool *ducks, int c,
+		  int (*find_duck)(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den));
+void collide(struct bullet_pool *bullets, struct duck_pool *ducks,
+	     int (*find_duck)(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den));
+void check_collisions(struct bullet_pool *bullets, struct duck_pool *ducks);
+void render_static_layer(struct game_snapshot *game);
+void render_hud_layer(struct game_snapshot *game);
+void autoplay(unsigned int tick);
+void bench_round(const struct bench_scenario *scenario);
+
+
+
+
+
+// Voice groups: shots and dry fire, reloads, quacks
+int voices_shots;
+int voices_reload;
+int voices_quack;
+
+// Fire sound
+Mix_Chunk *fire_chunk = NULL;
+Mix_Chunk *fire_dry_chunk = NULL;
+Mix_Chunk *cocking_chunk = NULL;
+Mix_Chunk *quack_chunk = NULL;
+
+
+
+struct sized_texture texture_background;
+// Hunter size, its pixels live in the image atlas
+struct sized_texture texture_hunter;
+#ifndef HEADLESS
+// Background pixels until they are uploaded
+SDL_Surface *surface_background = NULL;
+// Hunter, bullet and duck sprites packed in one texture
+struct image_atlas sprite_atlas;
+// Image atlas cache files prefix, NULL to always pack
+char *sprite_atlas_cache = "sprites_atlas";
+// Every sprite, submitted with a single draw call
+struct quad_batch sprite_batch;
+// Fired bullets, submitted with a single SDL_RenderFillRects call
+SDL_Rect *bullet_rects = NULL;
+int bullet_rects_capacity = 0;
+// Governor effects the textures are set up for, -1 before the first frame
+int textures_effects = -1;
+// Background with the hunters, changes with the number of players
+struct render_layer static_layer;
+int static_layer_players;
+// Bottom strip with counters, magazines and scores
+struct render_layer hud_layer;
+int hud_players;
+int hud_score[MAX_PLAYERS];
+int hud_magazine[MAX_PLAYERS];
+#endif
+
+
+/** GAME DATA **/
+// One per player the menu offers, NULL before the first round
+struct hunter *hunters = NULL;
+struct shot_gun *shotgun = NULL;
+struct bullet_pool bullets;
+struct duck_pool ducks;
+// Round storage: hunters, shotguns and both pools
+struct arena round_arena;
+// Bullet pool capacity
+int bullets_capacity = BULLETS_SIZE;
+// Ducks each player gets
+int flock_size = FLOCK_SIZE;
+// Autoplay fires every fire_interval ticks
+int fire_interval = 8;
+// Collision pass timings, only while benchmarking
+struct bench_samples *bench_collisions = NULL;
+// Entity kernels instruction set, NULL for the best available
+char *simd_kernels = NULL;
+int hunter_height;
+int hunter_width;
+int duck_height;
+int duck_width;
+// Speeds per simulation tick, fixed point
+int speed_bullet;
+int duck_speed;
+// Shot velocity, right and up
+int bullet_vx;
+int bullet_vy;
+// Collision broadphase
+struct duck_grid grid;
+// Flight path tables
+struct path_table paths;
+// Entity kernels in use
+struct entity_kernels kernels;
+
+
+/** ENTITY STORAGE **/
+int* alloc_field(int capacity, struct arena *arena)
+{
+  int *field;
+
+  // From the arena, NULL while it is being measured
+  if(arena != NULL)
+  {
+    field = arena_alloc(arena, capacity*sizeof(int));
+    if(field != NULL)
+    {
+      memset(field, 0, capacity*sizeof(int));
+    }
+    return field;
+  }
+  
+  // Aligned for the vector kernels
+  field = SDL_SIMDAlloc(capacity*sizeof(int));
+  if(field == NULL)
+  {
+    printf( "Unable to allocate %d entities!\n", capacity );
+    exit(-1);
+  }
+  memset(field, 0, capacity*sizeof(int));
+  return field;
+}
+
+void alloc_round()
+{
+  // Everything a round uses, sized by the configuration
+  hunters = arena_alloc(&round_arena, players_max*sizeof(struct hunter));
+  shotgun = arena_alloc(&round_arena, players_max*sizeof(struct shot_gun));
+  duck_pool_alloc(&ducks, players*flock_size, &round_arena);
+  bullet_pool_alloc(&bullets, bullets_capacity, &round_arena);
+}
+
+void duck_pool_alloc(struct duck_pool *pool, int capacity, struct arena *arena)
+{
+  duck_pool_free(pool);
+  pool->capacity=capacity;
+  pool->arena=arena;
+  pool->x=alloc_field(capacity, arena);
+  pool->y=alloc_field(capacity, arena);
+  pool->vx=alloc_field(capacity, arena);
+  pool->vy=alloc_field(capacity, arena);
+  pool->enabled=alloc_field(capacity, arena);
+  pool->path=alloc_field(capacity, arena);
+  pool->phase=alloc_field(capacity, arena);
+  pool->offset=alloc_field(capacity, arena);
+  pool->prev_x=alloc_field(capacity, arena);
+  pool->prev_y=alloc_field(capacity, arena);
+  pool->shoot_time=(unsigned int*)alloc_field(capacity, arena);
+}
+
+void duck_pool_free(struct duck_pool *pool)
+{
+  // Arena fields go when the arena is reset
+  if(pool->arena != NULL)
+  {
+    memset(pool, 0, sizeof(struct duck_pool));
+    return;
+  }
+  SDL_SIMDFree(pool->x);
+  SDL_SIMDFree(pool->y);
+  SDL_SIMDFree(pool->vx);
+  SDL_SIMDFree(pool->vy);
+  SDL_SIMDFree(pool->enabled);
+  SDL_SIMDFree(pool->path);
+  SDL_SIMDFree(pool->phase);
+  SDL_SIMDFree(pool->offset);
+  SDL_SIMDFree(pool->prev_x);
+  SDL_SIMDFree(pool->prev_y);
+  SDL_SIMDFree(pool->shoot_time);
+  memset(pool, 0, sizeof(struct duck_pool));
+}
+
+void bullet_pool_alloc(struct bullet_pool *pool, int capacity, struct arena *arena)
+{
+  bullet_pool_free(pool);
+  pool->capacity=capacity;
+  pool->arena=arena;
+  pool->x=alloc_field(capacity, arena);
+  pool->y=alloc_field(capacity, arena);
+  pool->vx=alloc_field(capacity, arena);
+  pool->vy=alloc_field(capacity, arena);
+  pool->enabled=alloc_field(capacity, arena);
+  pool->prev_x=alloc_field(capacity, arena);
+  pool->prev_y=alloc_field(capacity, arena);
+  pool->player=alloc_field(capacity, arena);
+  pool->fire_chord=alloc_field(capacity, arena);
+}
+
+void bullet_pool_free(struct bullet_pool *pool)
+{
+  // Arena fields go when the arena is reset
+  if(pool->arena != NULL)
+  {
+    memset(pool, 0, sizeof(struct bullet_pool));
+    return;
+  }
+  SDL_SIMDFree(pool->x);
+  SDL_SIMDFree(pool->y);
+  SDL_SIMDFree(pool->vx);
+  SDL_SIMDFree(pool->vy);
+  SDL_SIMDFree(pool->enabled);
+  SDL_SIMDFree(pool->prev_x);
+  SDL_SIMDFree(pool->prev_y);
+  SDL_SIMDFree(pool->player);
+  SDL_SIMDFree(pool->fire_chord);
+  memset(pool, 0, sizeof(struct bullet_pool));
+}
+
+int bullet_spawn(struct bullet_pool *pool)
+{
+  // Next free slot, -1 when the pool is full
+  if(pool->count == pool->capacity) return -1;
+  pool->enabled[pool->count]=1;
+  return pool->count++;
+}
+
+void bullet_despawn(struct bullet_pool *pool, int i)
+{
+  int last;
+  
+  // Move the last live bullet into the hole
+  last=--pool->count;
+  pool->x[i]=pool->x[last];
+  pool->y[i]=pool->y[last];
+  pool->vx[i]=pool->vx[last];
+  pool->vy[i]=pool->vy[last];
+  pool->enabled[i]=pool->enabled[last];
+  pool->prev_x[i]=pool->prev_x[last];
+  pool->prev_y[i]=pool->prev_y[last];
+  pool->player[i]=pool->player[last];
+  pool->fire_chord[i]=pool->fire_chord[last];
+}
+
+void bullet_remove_disabled(struct bullet_pool *pool)
+{
+  int i;
+  
+  i=0;
+  while(i<pool->count)
+  {
+    if(pool->enabled[i])
+    {
+      i++;
+    }
+    else
+    {
+      // Swapped in bullet is checked on next iteration
+      bullet_despawn(pool, i);
+    }
+  }
+}
+
+/** ENTITY KERNELS **/
+// Scalar kernels, also used for the tail of the vector ones
+void integrate_scalar(int *x, int *y, const int *vx, const int *vy, const int *enabled, int n)
+{
+  int i;
+
+  for(i=0; i<n; i++)
+  {
+    if(enabled==NULL || enabled[i])
+    {
+      x[i]+=vx[i];
+      y[i]+=vy[i];
+    }
+  }
+}
+
+void cull_ducks_scalar(const int *x, const int *y, int *vx, int *vy, int *enabled, int n, int width, int height)
+{
+  int i;
+
+  for(i=0; i<n; i++)
+  {
+    // Set speed to 0 to outscreen ducks
+    if(y[i]>height)
+    {
+      enabled[i]=0;
+      vx[i]=0;
+      vy[i]=0;
+    }
+    // Disable outscreen ducks
+    if(vx[i]>0 && x[i]>width)
+    {
+      enabled[i]=0;
+    }
+    if(vx[i]<0 && x[i]<0)
+    {
+      enabled[i]=0;
+    }
+  }
+}
+
+void cull_bullets_scalar(const int *x, const int *y, int *enabled, int n, int width, int height)
+{
+  int i;
+
+  for(i=0; i<n; i++)
+  {
+    if(y[i]>height || y[i]<0 || x[i]>width || x[i]<0)
+    {
+      enabled[i]=0;
+    }
+  }
+}
+
+int in_rect_scalar(const int *x, const int *y, int n, int x0, int y0, int x1, int y1, int *found)
+{
+  int i, count;
+
+  count=0;
+  for(i=0; i<n; i++)
+  {
+    if(x[i]>=x0 && x[i]<=x1 && y[i]>=y0 && y[i]<=y1)
+    {
+      found[count++]=i;
+    }
+  }
+  return count;
+}
+
+void follow_paths_scalar(const struct path_table *paths, const int *path, int *phase, const int *offset, const int *y, int *vy, const int *enabled, int n)
+{
+  int i, p, k, end, fraction;
+
+  for(i=0; i<n; i++)
+  {
+    p=path[i];
+    end=paths->length[p]<<PATH_PHASE_SHIFT;
+    phase[i]+=paths->step;
+    if(phase[i]>=end)
+    {
+      phase[i]=paths->loop[p] ? phase[i]-end : end;
+    }
+    k=paths->start[p]+(phase[i]>>PATH_PHASE_SHIFT);
+    fraction=phase[i]&((1<<PATH_PHASE_SHIFT)-1);
+    vy[i]=enabled[i] ? offset[i]+paths->y[k]+(((paths->y[k+1]-paths->y[k])*fraction)>>PATH_PHASE_SHIFT)-y[i] : 0;
+  }
+}
+
+struct entity_kernels scalar_kernels = {"scalar", integrate_scalar, cull_ducks_scalar, cull_bullets_scalar, in_rect_scalar, follow_paths_scalar};
+
+#if defined(__SSE2__)
+#define HAVE_SSE2_KERNELS
+#include <emmintrin.h>
+
+void integrate_sse2(int *x, int *y, const int *vx, const int *vy, const int *enabled, int n)
+{
+  __m128i mask;
+  int i;
+
+  // Enabled is 0 or 1, negated it masks the velocity
+  mask=_mm_set1_epi32(-1);
+  for(i=0; i+4<=n; i+=4)
+  {
+    if(enabled)
+    {
+      mask=_mm_sub_epi32(_mm_setzero_si128(), _mm_loadu_si128((const __m128i*)(enabled+i)));
+    }
+    _mm_storeu_si128((__m128i*)(x+i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(x+i)),
+						    _mm_and_si128(_mm_loadu_si128((const __m128i*)(vx+i)), mask)));
+    _mm_storeu_si128((__m128i*)(y+i), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(y+i)),
+						    _mm_and_si128(_mm_loadu_si128((const __m128i*)(vy+i)), mask)));
+  }
+  integrate_scalar(x+i, y+i, vx+i, vy+i, enabled ? enabled+i : NULL, n-i);
+}
+
+void cull_ducks_sse2(const int *x, const int *y, int *vx, int *vy, int *enabled, int n, int width, int height)
+{
+  __m128i zero, w, h, px, py, pvx, bottom, off;
+  int i;
+
+  zero=_mm_setzero_si128();
+  w=_mm_set1_epi32(width);
+  h=_mm_set1_epi32(height);
+  for(i=0; i+4<=n; i+=4)
+  {
+    px=_mm_loadu_si128((const __m128i*)(x+i));
+    py=_mm_loadu_si128((const __m128i*)(y+i));
+    pvx=_mm_loadu_si128((const __m128i*)(vx+i));
+    bottom=_mm_cmpgt_epi32(py, h);
+    off=_mm_or_si128(bottom,
+		     _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi32(pvx, zero), _mm_cmpgt_epi32(px, w)),
+				  _mm_and_si128(_mm_cmplt_epi32(pvx, zero), _mm_cmplt_epi32(px, zero))));
+    _mm_storeu_si128((__m128i*)(enabled+i), _mm_andnot_si128(off, _mm_loadu_si128((const __m128i*)(enabled+i))));
+    _mm_storeu_si128((__m128i*)(vx+i), _mm_andnot_si128(bottom, pvx));
+    _mm_storeu_si128((__m128i*)(vy+i), _mm_andnot_si128(bottom, _mm_loadu_si128((const __m128i*)(vy+i))));
+  }
+  cull_ducks_scalar(x+i, y+i, vx+i, vy+i, enabled+i, n-i, width, height);
+}
+
+void cull_bullets_sse2(const int *x, const int *y, int *enabled, int n, int width, int height)
+{
+  __m128i zero, w, h, px, py, off;
+  int i;
+
+  zero=_mm_setzero_si128();
+  w=_mm_set1_epi32(width);
+  h=_mm_set1_epi32(height);
+  for(i=0; i+4<=n; i+=4)
+  {
+    px=_mm_loadu_si128((const __m128i*)(x+i));
+    py=_mm_loadu_si128((const __m128i*)(y+i));
+    off=_mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(py, h), _mm_cmplt_epi32(py, zero)),
+		     _mm_or_si128(_mm_cmpgt_epi32(px, w), _mm_cmplt_epi32(px, zero)));
+    _mm_storeu_si128((__m128i*)(enabled+i), _mm_andnot_si128(off, _mm_loadu_si128((const __m128i*)(enabled+i))));
+  }
+  cull_bullets_scalar(x+i, y+i, enabled+i, n-i, width, height);
+}
+
+int in_rect_sse2(const int *x, const int *y, int n, int x0, int y0, int x1, int y1, int *found)
+{
+  __m128i vx0, vy0, vx1, vy1, bx, by, out;
+  int i, j, bits, count, tail;
+
+  count=0;
+  vx0=_mm_set1_epi32(x0);
+  vy0=_mm_set1_epi32(y0);
+  vx1=_mm_set1_epi32(x1);
+  vy1=_mm_set1_epi32(y1);
+  for(i=0; i+4<=n; i+=4)
+  {
+    bx=_mm_loadu_si128((const __m128i*)(x+i));
+    by=_mm_loadu_si128((const __m128i*)(y+i));
+    out=_mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(vx0, bx), _mm_cmpgt_epi32(bx, vx1)),
+		     _mm_or_si128(_mm_cmpgt_epi32(vy0, by), _mm_cmpgt_epi32(by, vy1)));
+    bits=~_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xF;
+    while(bits)
+    {
+      found[count++]=i+__builtin_ctz(bits);
+      bits&=bits-1;
+    }
+  }
+  tail=in_rect_scalar(x+i, y+i, n-i, x0, y0, x1, y1, found+count);
+  for(j=0; j<tail; j++)
+  {
+    found[count++]+=i;
+  }
+  return count;
+}
+
+// No gather before AVX2, paths are followed by the scalar loop
+struct entity_kernels sse2_kernels = {"sse2", integrate_sse2, cull_ducks_sse2, cull_bullets_sse2, in_rect_sse2, follow_paths_scalar};
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+void integrate_avx2(int *x, int *y, const int *vx, const int *vy, const int *enabled, int n)
+{
+  __m256i mask;
+  int i;
+
+  mask=_mm256_set1_epi32(-1);
+  for(i=0; i+8<=n; i+=8)
+  {
+    if(enabled)
+    {
+      mask=_mm256_sub_epi32(_mm256_setzero_si256(), _mm256_loadu_si256((const __m256i*)(enabled+i)));
+    }
+    _mm256_storeu_si256((__m256i*)(x+i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(x+i)),
+							  _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(vx+i)), mask)));
+    _mm256_storeu_si256((__m256i*)(y+i), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(y+i)),
+							  _mm256_and_si256(_mm256_loadu_si256((const __m256i*)(vy+i)), mask)));
+  }
+  integrate_scalar(x+i, y+i, vx+i, vy+i, enabled ? enabled+i : NULL, n-i);
+}
+
+__attribute__((target("avx2")))
+void cull_ducks_avx2(const int *x, const int *y, int *vx, int *vy, int *enabled, int n, int width, int height)
+{
+  __m256i zero, w, h, px, py, pvx, bottom, off;
+  int i;
+
+  zero=_mm256_setzero_si256();
+  w=_mm256_set1_epi32(width);
+  h=_mm256_set1_epi32(height);
+  for(i=0; i+8<=n; i+=8)
+  {
+    px=_mm256_loadu_si256((const __m256i*)(x+i));
+    py=_mm256_loadu_si256((const __m256i*)(y+i));
+    pvx=_mm256_loadu_si256((const __m256i*)(vx+i));
+    bottom=_mm256_cmpgt_epi32(py, h);
+    off=_mm256_or_si256(bottom,
+			_mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi32(pvx, zero), _mm256_cmpgt_epi32(px, w)),
+					_mm256_and_si256(_mm256_cmpgt_epi32(zero, pvx), _mm256_cmpgt_epi32(zero, px))));
+    _mm256_storeu_si256((__m256i*)(enabled+i), _mm256_andnot_si256(off, _mm256_loadu_si256((const __m256i*)(enabled+i))));
+    _mm256_storeu_si256((__m256i*)(vx+i), _mm256_andnot_si256(bottom, pvx));
+    _mm256_storeu_si256((__m256i*)(vy+i), _mm256_andnot_si256(bottom, _mm256_loadu_si256((const __m256i*)(vy+i))));
+  }
+  cull_ducks_scalar(x+i, y+i, vx+i, vy+i, enabled+i, n-i, width, height);
+}
+
+__attribute__((target("avx2")))
+void cull_bullets_avx2(const int *x, const int *y, int *enabled, int n, int width, int height)
+{
+  __m256i zero, w, h, px, py, off;
+  int i;
+
+  zero=_mm256_setzero_si256();
+  w=_mm256_set1_epi32(width);
+  h=_mm256_set1_epi32(height);
+  for(i=0; i+8<=n; i+=8)
+  {
+    px=_mm256_loadu_si256((const __m256i*)(x+i));
+    py=_mm256_loadu_si256((const __m256i*)(y+i));
+    off=_mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(py, h), _mm256_cmpgt_epi32(zero, py)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(px, w), _mm256_cmpgt_epi32(zero, px)));
+    _mm256_storeu_si256((__m256i*)(enabled+i), _mm256_andnot_si256(off, _mm256_loadu_si256((const __m256i*)(enabled+i))));
+  }
+  cull_bullets_scalar(x+i, y+i, enabled+i, n-i, width, height);
+}
+
+__attribute__((target("avx2")))
+int in_rect_avx2(const int *x, const int *y, int n, int x0, int y0, int x1, int y1, int *found)
+{
+  __m256i vx0, vy0, vx1, vy1, bx, by, out;
+  int i, j, bits, count, tail;
+
+  count=0;
+  vx0=_mm256_set1_epi32(x0);
+  vy0=_mm256_set1_epi32(y0);
+  vx1=_mm256_set1_epi32(x1);
+  vy1=_mm256_set1_epi32(y1);
+  for(i=0; i+8<=n; i+=8)
+  {
+    bx=_mm256_loadu_si256((const __m256i*)(x+i));
+    by=_mm256_loadu_si256((const __m256i*)(y+i));
+    out=_mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(vx0, bx), _mm256_cmpgt_epi32(bx, vx1)),
+			_mm256_or_si256(_mm256_cmpgt_epi32(vy0, by), _mm256_cmpgt_epi32(by, vy1)));
+    bits=~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xFF;
+    while(bits)
+    {
+      found[count++]=i+__builtin_ctz(bits);
+      bits&=bits-1;
+    }
+  }
+  tail=in_rect_scalar(x+i, y+i, n-i, x0, y0, x1, y1, found+count);
+  for(j=0; j<tail; j++)
+  {
+    found[count++]+=i;
+  }
+  return count;
+}
+
+__attribute__((target("avx2")))
+void follow_paths_avx2(const struct path_table *paths, const int *path, int *phase, const int *offset, const int *y, int *vy, const int *enabled, int n)
+{
+  __m256i step, fraction, p, end, t, k, y0, y1, height, mask;
+  int i;
+
+  step=_mm256_set1_epi32(paths->step);
+  fraction=_mm256_set1_epi32((1<<PATH_PHASE_SHIFT)-1);
+  for(i=0; i+8<=n; i+=8)
+  {
+    // Past the end, loop or stay on the last sample
+    p=_mm256_loadu_si256((const __m256i*)(path+i));
+    end=_mm256_slli_epi32(_mm256_i32gather_epi32(paths->length, p, 4), PATH_PHASE_SHIFT);
+    t=_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(phase+i)), step);
+    t=_mm256_blendv_epi8(t, _mm256_blendv_epi8(end, _mm256_sub_epi32(t, end),
+					       _mm256_cmpgt_epi32(_mm256_i32gather_epi32(paths->loop, p, 4), _mm256_setzero_si256())),
+			 _mm256_cmpgt_epi32(t, _mm256_sub_epi32(end, _mm256_set1_epi32(1))));
+    _mm256_storeu_si256((__m256i*)(phase+i), t);
+    // Samples around the phase of the eight ducks, two gathers
+    k=_mm256_add_epi32(_mm256_i32gather_epi32(paths->start, p, 4), _mm256_srai_epi32(t, PATH_PHASE_SHIFT));
+    y0=_mm256_i32gather_epi32(paths->y, k, 4);
+    y1=_mm256_i32gather_epi32(paths->y+1, k, 4);
+    height=_mm256_add_epi32(y0, _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_sub_epi32(y1, y0), _mm256_and_si256(t, fraction)), PATH_PHASE_SHIFT));
+    mask=_mm256_sub_epi32(_mm256_setzero_si256(), _mm256_loadu_si256((const __m256i*)(enabled+i)));
+    _mm256_storeu_si256((__m256i*)(vy+i), _mm256_and_si256(_mm256_sub_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(offset+i)), height),
+									 _mm256_loadu_si256((const __m256i*)(y+i))), mask));
+  }
+  follow_paths_scalar(paths, path+i, phase+i, offset+i, y+i, vy+i, enabled+i, n-i);
+}
+
+struct entity_kernels avx2_kernels = {"avx2", integrate_avx2, cull_ducks_avx2, cull_bullets_avx2, in_rect_avx2, follow_paths_avx2};
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+
+void integrate_neon(int *x, int *y, const int *vx, const int *vy, const int *enabled, int n)
+{
+  int32x4_t mask;
+  int i;
+
+  mask=vdupq_n_s32(-1);
+  for(i=0; i+4<=n; i+=4)
+  {
+    if(enabled)
+    {
+      mask=vnegq_s32(vld1q_s32(enabled+i));
+    }
+    vst1q_s32(x+i, vaddq_s32(vld1q_s32(x+i), vandq_s32(vld1q_s32(vx+i), mask)));
+    vst1q_s32(y+i, vaddq_s32(vld1q_s32(y+i), vandq_s32(vld1q_s32(vy+i), mask)));
+  }
+  integrate_scalar(x+i, y+i, vx+i, vy+i, enabled ? enabled+i : NULL, n-i);
+}
+
+void cull_ducks_neon(const int *x, const int *y, int *vx, int *vy, int *enabled, int n, int width, int height)
+{
+  int32x4_t zero, w, h, px, py, pvx;
+  uint32x4_t bottom, off;
+  int i;
+
+  zero=vdupq_n_s32(0);
+  w=vdupq_n_s32(width);
+  h=vdupq_n_s32(height);
+  for(i=0; i+4<=n; i+=4)
+  {
+    px=vld1q_s32(x+i);
+    py=vld1q_s32(y+i);
+    pvx=vld1q_s32(vx+i);
+    bottom=vcgtq_s32(py, h);
+    off=vorrq_u32(bottom,
+		  vorrq_u32(vandq_u32(vcgtq_s32(pvx, zero), vcgtq_s32(px, w)),
+			    vandq_u32(vcltq_s32(pvx, zero), vcltq_s32(px, zero))));
+    vst1q_s32(enabled+i, vbicq_s32(vld1q_s32(enabled+i), vreinterpretq_s32_u32(off)));
+    vst1q_s32(vx+i, vbicq_s32(pvx, vreinterpretq_s32_u32(bottom)));
+    vst1q_s32(vy+i, vbicq_s32(vld1q_s32(vy+i), vreinterpretq_s32_u32(bottom)));
+  }
+  cull_ducks_scalar(x+i, y+i, vx+i, vy+i, enabled+i, n-i, width, height);
+}
+
+void cull_bullets_neon(const int *x, const int *y, int *enabled, int n, int width, int height)
+{
+  int32x4_t zero, w, h, px, py;
+  uint32x4_t off;
+  int i;
+
+  zero=vdupq_n_s32(0);
+  w=vdupq_n_s32(width);
+  h=vdupq_n_s32(height);
+  for(i=0; i+4<=n; i+=4)
+  {
+    px=vld1q_s32(x+i);
+    py=vld1q_s32(y+i);
+    off=vorrq_u32(vorrq_u32(vcgtq_s32(py, h), vcltq_s32(py, zero)),
+		  vorrq_u32(vcgtq_s32(px, w), vcltq_s32(px, zero)));
+    vst1q_s32(enabled+i, vbicq_s32(vld1q_s32(enabled+i), vreinterpretq_s32_u32(off)));
+  }
+  cull_bullets_scalar(x+i, y+i, enabled+i, n-i, width, height);
+}
+
+int in_rect_neon(const int *x, const int *y, int n, int x0, int y0, int x1, int y1, int *found)
+{
+  int32x4_t vx0, vy0, vx1, vy1, bx, by;
+  uint32x4_t in;
+  uint32_t lanes[4];
+  int i, j, lane, count, tail;
+
+  count=0;
+  vx0=vdupq_n_s32(x0);
+  vy0=vdupq_n_s32(y0);
+  vx1=vdupq_n_s32(x1);
+  vy1=vdupq_n_s32(y1);
+  for(i=0; i+4<=n; i+=4)
+  {
+    bx=vld1q_s32(x+i);
+    by=vld1q_s32(y+i);
+    in=vandq_u32(vandq_u32(vcgeq_s32(bx, vx0), vcleq_s32(bx, vx1)),
+		 vandq_u32(vcgeq_s32(by, vy0), vcleq_s32(by, vy1)));
+    vst1q_u32(lanes, in);
+    for(lane=0; lane<4; lane++)
+    {
+      if(lanes[lane])
+      {
+	found[count++]=i+lane;
+      }
+    }
+  }
+  tail=in_rect_scalar(x+i, y+i, n-i, x0, y0, x1, y1, found+count);
+  for(j=0; j<tail; j++)
+  {
+    found[count++]+=i;
+  }
+  return count;
+}
+
+// No gather in NEON, paths are followed by the scalar loop
+struct entity_kernels neon_kernels = {"neon", integrate_neon, cull_ducks_neon, cull_bullets_neon, in_rect_neon, follow_paths_scalar};
+#endif
+
+void init_kernels(char *name)
+{
+  struct entity_kernels available[4];
+  int i, count;
+
+  // Kernels this CPU can run, best last
+  count=0;
+  available[count++]=scalar_kernels;
+#ifdef HAVE_SSE2_KERNELS
+  if(SDL_HasSSE2())
+  {
+    available[count++]=sse2_kernels;
+  }
+#endif
+#ifdef HAVE_AVX2_KERNELS
+  if(SDL_HasAVX2())
+  {
+    available[count++]=avx2_kernels;
+  }
+#endif
+#ifdef HAVE_NEON_KERNELS
+  if(SDL_HasNEON())
+  {
+    available[count++]=neon_kernels;
+  }
+#endif
+  kernels=available[count-1];
+
+  // Requested instruction set
+  if(name != NULL)
+  {
+    for(i=0; i<count; i++)
+    {
+      if(strcmp(available[i].name, name) == 0)
+      {
+	kernels=available[i];
+	return;
+      }
+    }
+    printf( "Kernels %s not available on this CPU\n", name );
+    exit(-1);
+  }
+}
+
+void paths_bake()
+{
+  int p, k, count, hang, drop;
+  
+  // Same heights at every tick rate, only the phase step changes
+  paths.step=(int)((((Sint64)SIM_BASE_RATE<<PATH_PHASE_SHIFT) + sim_rate/2)/sim_rate);
+  paths.chords=(SIM_BASE_RATE + sim_rate-1)/sim_rate;
+  if(paths.height == duck_height && paths.screen_height == SCREEN_HEIGHT) return;
+  paths.height=duck_height;
+  paths.screen_height=SCREEN_HEIGHT;
+  
+  // Flights loop. Shot ducks hang until 10 base ticks after the one they
+  // were hit in, then drop until they are below the screen
+  hang=10;
+  drop=TO_FIXED(DUCK_FALL_SPEED);
+  for(p=0; p<PATH_FLIGHTS; p++)
+  {
+    paths.length[p]=PATH_LAP;
+    paths.loop[p]=1;
+  }
+  paths.length[PATH_FALL]=hang+TO_FIXED(SCREEN_HEIGHT+2*duck_height)/drop+1;
+  paths.loop[PATH_FALL]=0;
+  
+  count=0;
+  for(p=0; p<PATH_COUNT; p++)
+  {
+    paths.start[p]=count;
+    count+=paths.length[p]+2;
+  }
+  if(count > paths.y_capacity)
+  {
+    paths.y_capacity=count;
+    paths.y=realloc(paths.y, paths.y_capacity*sizeof(int));
+    if(paths.y==NULL)
+    {
+      printf("Unable to allocate %d path samples\n", paths.y_capacity);
+      exit(-1);
+    }
+  }
+  
+  for(p=0; p<PATH_FLIGHTS; p++)
+  {
+    for(k=0; k<paths.length[p]+2; k++)
+    {
+      paths.y[paths.start[p]+k]=path_height(p, k%PATH_LAP);
+    }
+  }
+  for(k=0; k<paths.length[PATH_FALL]+2; k++)
+  {
+    paths.y[paths.start[PATH_FALL]+k]=k<hang ? 0 : (k<paths.length[PATH_FALL] ? k : paths.length[PATH_FALL])*drop-hang*drop;
+  }
+}
+
+int path_height(int path, int sample)
+{
+  // Closed spline heights, in duck heights
+  static const double spline[] = {0.0, -1.5, -0.5, 1.0, -1.0, 0.5};
+  int count, segment;
+  double u, t, p0, p1, p2, p3, height;
+  
+  // Fraction of the lap, below the flight line is positive
+  u=(double)sample/PATH_LAP;
+  height=0.0;
+  switch(path)
+  {
+  case PATH_SINE:
+    // Two waves a duck high
+    height=sin(4.0*M_PI*u);
+    break;
+  case PATH_DIVE:
+    // Steep drop of three ducks and back up
+    height=3.0*pow(sin(M_PI*u), 6.0);
+    break;
+  case PATH_SPLINE:
+    // Catmull-Rom through the points, wrapping around
+    count=sizeof(spline)/sizeof(spline[0]);
+    segment=(int)(u*count);
+    t=u*count-segment;
+    p0=spline[(segment+count-1)%count];
+    p1=spline[segment];
+    p2=spline[(segment+1)%count];
+    p3=spline[(segment+2)%count];
+    height=0.5*(2.0*p1 + (p2-p0)*t + (2.0*p0-5.0*p1+4.0*p2-p3)*t*t + (3.0*p1-p0-3.0*p2+p3)*t*t*t);
+    break;
+  }
+  return (int)lround(TO_FIXED(duck_height)*height);
+}
+
+int path_y(int path, int phase)
+{
+  int k, fraction;
+  
+  // Height of a path at a phase, as follow_paths finds it
+  k=paths.start[path]+(phase>>PATH_PHASE_SHIFT);
+  fraction=phase&((1<<PATH_PHASE_SHIFT)-1);
+  return paths.y[k]+(((paths.y[k+1]-paths.y[k])*fraction)>>PATH_PHASE_SHIFT);
+}
+
+#ifndef HEADLESS
+void load_media()
+{ 
+  // Voices: reloads may take the oldest shot, quacks never take any
+  voices_shots=voice_group_add("shots", 2*players_max, 1, 1);
+  voices_reload=voice_group_add("reload", players_max, 2, 0);
+  voices_quack=voice_group_add("quack", 1, 0, 0);
+  
+  // Queued largest first so no worker is left with a long tail
+  // Load firing chunk
+  asset_queue(ASSET_SOUND, "firing.wav", 0, &fire_chunk);
+  
+  // Load cooking chunk
+  asset_queue(ASSET_SOUND, "cocking.wav", 0, &cocking_chunk);
+  
+  // Load dry firing chunk
+  asset_queue(ASSET_SOUND, "firing_dry.wav", 0, &fire_dry_chunk);
+  
+  // Load quack
+  asset_queue(ASSET_SOUND, "quack.wav", 0, &quack_chunk);
+  
+  //Load background 
+  asset_queue(ASSET_IMAGE, "field.png", 0, &surface_background);
+  
+  // Pack hunter, bullet and the used duck frames, same order as sprite_id
+  image_atlas_add(&sprite_atlas, "hunter.png", 0, 0, 0, 0);
+  image_atlas_add(&sprite_atlas, "bullet.png", 0, 0, 0, 0);
+  image_atlas_add(&sprite_atlas, "duckhunt_sprites.png", 130, 120, DUCK_WIDTH, DUCK_HEIGHT);
+  image_atlas_add(&sprite_atlas, "duckhunt_sprites.png", 170, 120, DUCK_WIDTH, DUCK_HEIGHT);
+  image_atlas_add(&sprite_atlas, "duckhunt_sprites.png", 210, 120, DUCK_WIDTH, DUCK_HEIGHT);
+  image_atlas_add(&sprite_atlas, "duckhunt_sprites.png", 131, 238, DUCK_WIDTH, DUCK_HEIGHT);
+  image_atlas_add(&sprite_atlas, "duckhunt_sprites.png", 178, 237, DUCK_WIDTH, DUCK_HEIGHT);
+  asset_queue(ASSET_IMAGE_ATLAS, sprite_atlas_cache, 0, &sprite_atlas);
+}
+
+void upload_media()
+{
+  // Background
+  upload_texture(&texture_background, surface_background, "field.png");
+  surface_background=NULL;
+  
+  // Sprites
+  image_atlas_upload(&sprite_atlas);
+  texture_hunter.texture=sprite_atlas.texture;
+  texture_hunter.width=sprite_atlas.entries[SPRITE_HUNTER].rect.w;
+  texture_hunter.height=sprite_atlas.entries[SPRITE_HUNTER].rect.h;
+  
+  // Hunters, ducks, counters and both magazines
+  batch_init(&sprite_batch, 2+2*FLOCK_SIZE+2+2*MAGAZINE_SIZE);
+}
+
+void close_media()
+{
+  // Free sound effects
+  Mix_FreeChunk(fire_chunk);
+  Mix_FreeChunk(fire_dry_chunk);
+  Mix_FreeChunk(cocking_chunk);
+  Mix_FreeChunk(quack_chunk);
+  
+  // Destroy textures
+  SDL_DestroyTexture(texture_background.texture);
+  image_atlas_free(&sprite_atlas);
+  texture_hunter.texture=NULL;
+  
+  // Free cached layers
+  layer_free(&static_layer);
+  layer_free(&hud_layer);
+  
+  // Free sprite batch
+  batch_free(&sprite_batch);
+  free(bullet_rects);
+  bullet_rects=NULL;
+  bullet_rects_capacity=0;
+}
+#endif
+
+void init_game()
+{
+  int i,j,k,p,wave,lanes;
+  
+  if(SCREEN_HEIGHT>600)
+  {
+    hunter_height=2*texture_hunter.height;
+    hunter_width=2*texture_hunter.width;
+    duck_height=2*DUCK_HEIGHT;
+    duck_width=2*DUCK_WIDTH;
+    speed_bullet=2*SPEED_BULLET;
+  }
+  else
+  {
+    hunter_height=texture_hunter.height;
+    hunter_width=texture_hunter.width;
+    duck_height=DUCK_HEIGHT;
+    duck_width=DUCK_WIDTH;
+    speed_bullet=SPEED_BULLET;
+  }
+  
+  // Speeds are given per base tick, scale them to the simulation rate.
+  // The shot is rounded for a quarter of a base tick first, rates from
+  // 25 to 200 Hz then move it exactly as far in the same time
+  bullet_vx=(int)(((Sint64)TO_FIXED(speed_bullet)/4*BULLET_COS + (1<<15))>>16);
+  bullet_vy=(int)(((Sint64)TO_FIXED(speed_bullet)/4*BULLET_SIN + (1<<15))>>16);
+  bullet_vx=(bullet_vx*4*SIM_BASE_RATE + sim_rate/2)/sim_rate;
+  bullet_vy=-((bullet_vy*4*SIM_BASE_RATE + sim_rate/2)/sim_rate);
+  speed_bullet=(TO_FIXED(speed_bullet)*SIM_BASE_RATE + sim_rate/2)/sim_rate;
+  duck_speed=(TO_FIXED(DUCK_SPEED)*SIM_BASE_RATE + sim_rate/2)/sim_rate;
+  
+  // Entity kernels, set up once
+  if(kernels.name == NULL)
+  {
+    init_kernels(simd_kernels);
+  }
+  
+  // Flight paths for this duck size and screen
+  paths_bake();
+  
+  // Round storage, carved again from the arena every round
+  arena_reset(&round_arena);
+  alloc_round();
+  if(round_arena.used > round_arena.size)
+  {
+    // First round or a bigger configuration
+    arena_init(&round_arena, round_arena.used);
+    alloc_round();
+  }
+  
+  // Hunters: even players on the left, odd ones on the right, inwards
+  for(i=0; i<players_max; i++)
+  {
+    if(i%2==0)
+    {
+      hunters[i].x=10+i/2*(hunter_width+10);
+    }
+    else
+    {
+      hunters[i].x=SCREEN_WIDTH-110-i/2*(hunter_width+10);
+    }
+    hunters[i].y=SCREEN_HEIGHT-hunter_height-40;
+    hunters[i].score=0;
+    shotgun[i].magazine=MAGAZINE_SIZE;
+    shotgun[i].cocking_time=0;
+    shotgun[i].cocking_phase=0;
+  }
+  
+  // Init bullets
+  bullets.count=0;
+  
+  // One flock per player, from the left for even players. Waves after
+  // the first fly in lower lanes, then further out
+  lanes=(SCREEN_HEIGHT/2-100)/100;
+  if(lanes<1) lanes=1;
+  ducks.size=players*flock_size;
+  for(p=0; p<players; p++)
+  {
+    for(k=0; k<flock_size; k++)
+    {
+      i=p*flock_size+k;
+      j=k%FLOCK_WAVE;
+      wave=k/FLOCK_WAVE+p/2;
+      if(p%2==0)
+      {
+	ducks.x[i]=TO_FIXED(DUCK_START_X-300*j-200*(j%2)-150*(wave/lanes));
+	ducks.y[i]=TO_FIXED(50+50*(j%2)+100*(wave%lanes));
+	ducks.vx[i]=duck_speed;
+      }
+      else
+      {
+	ducks.x[i]=TO_FIXED(SCREEN_WIDTH+300*j+200*(j%2)+150*(wave/lanes));
+	ducks.y[i]=TO_FIXED(20+50*(j%2)+100*(wave%lanes));
+	ducks.vx[i]=-duck_speed;
+      }
+      ducks.vy[i]=0;
+      // Paths change from duck to duck and wave to wave, neighbours
+      // out of step. Lanes are the height paths are flown from
+      ducks.path[i]=(j+wave)%PATH_FLIGHTS;
+      ducks.phase[i]=(j*PATH_LAP/FLOCK_WAVE)<<PATH_PHASE_SHIFT;
+      ducks.offset[i]=ducks.y[i];
+      ducks.y[i]+=path_y(ducks.path[i], ducks.phase[i]);
+      ducks.prev_x[i]=ducks.x[i];
+      ducks.prev_y[i]=ducks.y[i];
+      ducks.shoot_time[i]=0;
+      ducks.enabled[i]=1;
+    }
+  }
+  
+  // Broadphase storage sized for the round, ticks do not allocate
+  grid_build(&ducks);
+}
+
+void update_game()
+{
+  int i,j, all_ducks_disabled;
+  Uint64 start;
+  
+  if(game_over || pause) return;
+  
+  // Keep previous positions for interpolation
+  memcpy(ducks.prev_x, ducks.x, ducks.size*sizeof(int));
+  memcpy(ducks.prev_y, ducks.y, ducks.size*sizeof(int));
+  
+  // Disable outscreen ducks, set speed to 0 to ducks below the screen
+  kernels.cull_ducks(ducks.x, ducks.y, ducks.vx, ducks.vy, ducks.enabled, ducks.size, TO_FIXED(SCREEN_WIDTH), TO_FIXED(SCREEN_HEIGHT));
+  
+  // Update ducks speed from their paths, then position
+  kernels.follow_paths(&paths, ducks.path, ducks.phase, ducks.offset, ducks.y, ducks.vy, ducks.enabled, ducks.size);
+  kernels.integrate(ducks.x, ducks.y, ducks.vx, ducks.vy, NULL, ducks.size);
+  
+  // Update shotgun status
+  for(j=0; j<players; j++)
+  {
+    if(frames == shotgun[j].cocking_time)
+    {
+      shotgun[j].magazine=MAGAZINE_SIZE;
+    }
+  }
+  
+  // Update bullets
+  memcpy(bullets.prev_x, bullets.x, bullets.count*sizeof(int));
+  memcpy(bullets.prev_y, bullets.y, bullets.count*sizeof(int));
+  kernels.cull_bullets(bullets.x, bullets.y, bullets.enabled, bullets.count, TO_FIXED(SCREEN_WIDTH), TO_FIXED(SCREEN_HEIGHT));
+  bullet_remove_disabled(&bullets);
+  kernels.integrate(bullets.x, bullets.y, bullets.vx, bullets.vy, NULL, bullets.count);
+  
+  // Check collisions, timed on their own by the benchmark
+  if(bench_collisions != NULL)
+  {
+    start=SDL_GetPerformanceCounter();
+    check_collisions(&bullets, &ducks);
+    bench_add(bench_collisions, start, SDL_GetPerformanceCounter());
+  }
+  else
+  {
+    check_collisions(&bullets, &ducks);
+  }
+  memset(bullets.fire_chord, 0, bullets.count*sizeof(int));
+  
+  // Check if end of game
+  all_ducks_disabled=1;
+  for(i=0; i<ducks.size; i++)
+  {
+    if(ducks.enabled[i])
+    {
+      all_ducks_disabled=0;
+      break;
+    }
+  }
+  if(all_ducks_disabled)
+  {
+    game_over=1;
+  }
+  
+  // Play quacks
+  if(!game_over && frames%sim_ticks(90)==0)
+  {
+    play_sound(quack_chunk, voices_quack);
+  }
+}
+
+void grid_build(struct duck_pool *ducks)
+{
+  int i, c, x, y, cell, cells, margin;
+  
+  // Ducks move this much at most, a bullet path can meet one that far.
+  // Long ticks sweep along the path, which can bulge past the ends
+  grid.reach = 0;
+  for(i=0; i<ducks->size; i++)
+  {
+    for(c=0; c<paths.chords; c++)
+    {
+      duck_corner(ducks, i, c, &x, &y);
+      if(abs(ducks->x[i]-x) > grid.reach) grid.reach = abs(ducks->x[i]-x);
+      if(abs(ducks->y[i]-y) > grid.reach) grid.reach = abs(ducks->y[i]-y);
+    }
+  }
+  
+  // Cells at least as big as a duck, a query covers the cells of the
+  // corners a duck touching the bullet path can have
+  grid.cell_size = TO_FIXED(duck_width > duck_height ? duck_width : duck_height);
+  margin = speed_bullet+FIXED_ONE+grid.reach;
+  grid.min_x = -margin;
+  grid.min_y = -margin;
+  grid.max_x = TO_FIXED(SCREEN_WIDTH)+margin;
+  grid.max_y = TO_FIXED(SCREEN_HEIGHT)+margin;
+  grid.columns = (grid.max_x-grid.min_x)/grid.cell_size+1;
+  grid.rows = (grid.max_y-grid.min_y)/grid.cell_size+1;
+  cells = grid.columns*grid.rows;
+  
+  // Grow storage, only when the screen or the flock gets bigger
+  if(cells+1 > grid.cells_capacity)
+  {
+    grid.cells_capacity = cells+1;
+    grid.cell_start = realloc(grid.cell_start, grid.cells_capacity*sizeof(int));
+  }
+  if(ducks->size > grid.ducks_capacity)
+  {
+    grid.ducks_capacity = ducks->size;
+    grid.cell_ducks = realloc(grid.cell_ducks, grid.ducks_capacity*sizeof(int));
+    grid.cell_x = realloc(grid.cell_x, grid.ducks_capacity*sizeof(int));
+    grid.cell_y = realloc(grid.cell_y, grid.ducks_capacity*sizeof(int));
+    grid.duck_cell = realloc(grid.duck_cell, grid.ducks_capacity*sizeof(int));
+    grid.candidates = realloc(grid.candidates, grid.ducks_capacity*sizeof(int));
+    grid.hit_num = realloc(grid.hit_num, grid.ducks_capacity*sizeof(Sint64));
+    grid.hit_den = realloc(grid.hit_den, grid.ducks_capacity*sizeof(Sint64));
+    grid.hit_bullet = realloc(grid.hit_bullet, grid.ducks_capacity*sizeof(int));
+    grid.hit_ducks = realloc(grid.hit_ducks, grid.ducks_capacity*sizeof(int));
+    grid.shot_num = realloc(grid.shot_num, grid.ducks_capacity*sizeof(Sint64));
+    grid.shot_den = realloc(grid.shot_den, grid.ducks_capacity*sizeof(Sint64));
+    grid.shot_ducks = realloc(grid.shot_ducks, grid.ducks_capacity*sizeof(int));
+    memset(grid.hit_den, 0, grid.ducks_capacity*sizeof(Sint64));
+    memset(grid.shot_den, 0, grid.ducks_capacity*sizeof(Sint64));
+  }
+  
+  // Count enabled ducks bullets can reach in each cell
+  memset(grid.cell_start, 0, (cells+1)*sizeof(int));
+  for(i=0; i<ducks->size; i++)
+  {
+    grid.duck_cell[i]=-1;
+    if(ducks->enabled[i]
+      && ducks->x[i]+TO_FIXED(duck_width) > grid.min_x && ducks->x[i] < grid.max_x
+      && ducks->y[i]+TO_FIXED(duck_height) > grid.min_y && ducks->y[i] < grid.max_y)
+    {
+      grid.duck_cell[i]=grid_cell(ducks->x[i], ducks->y[i]);
+      grid.cell_start[grid.duck_cell[i]+1]++;
+    }
+  }
+  
+  // Prefix sum, then place ducks in index order inside each cell
+  for(i=0; i<cells; i++)
+  {
+    grid.cell_start[i+1]+=grid.cell_start[i];
+  }
+  for(i=0; i<ducks->size; i++)
+  {
+    cell=grid.duck_cell[i];
+    if(cell>=0)
+    {
+      grid.cell_ducks[grid.cell_start[cell]]=i;
+      grid.cell_x[grid.cell_start[cell]]=ducks->x[i];
+      grid.cell_y[grid.cell_start[cell]]=ducks->y[i];
+      grid.cell_start[cell]++;
+    }
+  }
+  // Placing advanced each start to the next cell, shift back
+  for(i=cells; i>0; i--)
+  {
+    grid.cell_start[i]=grid.cell_start[i-1];
+  }
+  grid.cell_start[0]=0;
+}
+
+int grid_cell(int x, int y)
+{
+  int column, row;
+  
+  // Points outside the grid are clamped to the border cells
+  column = (x-grid.min_x)/grid.cell_size;
+  row = (y-grid.min_y)/grid.cell_size;
+  if(column<0) column=0;
+  if(column>=grid.columns) column=grid.columns-1;
+  if(row<0) row=0;
+  if(row>=grid.rows) row=grid.rows-1;
+  return row*grid.columns+column;
+}
+
+int grid_find_duck(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den)
+{
+  int x0, y0, x1, y1, first, last, r, k, n, j, start, found;
+  Sint64 hit_num, hit_den, found_num, found_den;
+  
+  // Corners of the ducks that can touch the bullet path: its bounds,
+  // grown by a duck up and left and by the most a duck moved
+  x0=(bullets->prev_x[i] < bullets->x[i] ? bullets->prev_x[i] : bullets->x[i]) - TO_FIXED(duck_width) - grid.reach;
+  y0=(bullets->prev_y[i] < bullets->y[i] ? bullets->prev_y[i] : bullets->y[i]) - TO_FIXED(duck_height) - grid.reach;
+  x1=(bullets->prev_x[i] > bullets->x[i] ? bullets->prev_x[i] : bullets->x[i]) + grid.reach;
+  y1=(bullets->prev_y[i] > bullets->y[i] ? bullets->prev_y[i] : bullets->y[i]) + grid.reach;
+  first=grid_cell(x0, y0);
+  last=grid_cell(x1, y1);
+  
+  // Duck hit first during base tick c, lowest index on a tie, and when
+  // as a fraction of the tick. -1 if none
+  found=-1;
+  found_num=0;
+  found_den=1;
+  for(r=first/grid.columns; r<=last/grid.columns; r++)
+  {
+    // Cells of a row are contiguous in the grid
+    start=grid.cell_start[r*grid.columns + first%grid.columns];
+    n=kernels.in_rect(grid.cell_x+start, grid.cell_y+start, grid.cell_start[r*grid.columns + last%grid.columns + 1]-start,
+		      x0, y0, x1, y1, grid.candidates);
+    for(k=0; k<n; k++)
+    {
+      // Bullet motion relative to the duck, from its previous corner
+      j=grid.cell_ducks[start+grid.candidates[k]];
+      if(sweep_duck(bullets, i, ducks, j, c, &hit_num, &hit_den)
+	&& (found<0 || hit_num*found_den < found_num*hit_den || (hit_num*found_den == found_num*hit_den && j<found)))
+      {
+	found=j;
+	found_num=hit_num;
+	found_den=hit_den;
+      }
+    }
+  }
+  *num=found_num;
+  *den=found_den;
+  return found;
+}
+
+int sweep_box(int sx, int sy, int dx, int dy, int width, int height, Sint64 *num, Sint64 *den)
+{
+  Sint64 in_num[2], in_den[2], out_num[2], out_den[2];
+  int s[2], d[2], size[2], a;
+  
+  // Times of a point going from s by d in the tick is strictly inside a
+  // box at the origin, per axis, as fractions of the tick
+  s[0]=sx; s[1]=sy;
+  d[0]=dx; d[1]=dy;
+  size[0]=width; size[1]=height;
+  for(a=0; a<2; a++)
+  {
+    if(d[a]==0)
+    {
+      // Still on this axis: inside all the tick, or never
+      if(s[a]<=0 || s[a]>=size[a]) return 0;
+      in_num[a]=-1; in_den[a]=1;
+      out_num[a]=2; out_den[a]=1;
+    }
+    else if(d[a]>0)
+    {
+      in_num[a]=-s[a]; in_den[a]=d[a];
+      out_num[a]=size[a]-s[a]; out_den[a]=d[a];
+    }
+    else
+    {
+      in_num[a]=s[a]-size[a]; in_den[a]=-d[a];
+      out_num[a]=s[a]; out_den[a]=-d[a];
+    }
+  }
+  
+  // Inside on both axes from the later entry to the earlier exit
+  a = in_num[1]*in_den[0] > in_num[0]*in_den[1];
+  *num=in_num[a];
+  *den=in_den[a];
+  a = out_num[1]*out_den[0] < out_num[0]*out_den[1];
+  
+  // Hit when that overlaps the tick, at the entry or at its start
+  if(*num * out_den[a] >= out_num[a] * *den || *num >= *den || out_num[a] <= 0) return 0;
+  if(*num < 0)
+  {
+    *num=0;
+    *den=1;
+  }
+  return 1;
+}
+
+void duck_corner(struct duck_pool *ducks, int j, int c, int *x, int *y)
+{
+  int end, phase;
+  
+  // Corner c base ticks into the tick. Between the ends of a long tick
+  // it is on the path, from the phase the tick started at
+  if(c==0 || c==paths.chords)
+  {
+    *x=c==0 ? ducks->prev_x[j] : ducks->x[j];
+    *y=c==0 ? ducks->prev_y[j] : ducks->y[j];
+    return;
+  }
+  // Back from the end at its speed, shot ducks stay where they were hit
+  *x=ducks->x[j]-(int)((Sint64)ducks->vx[j]*(paths.chords-c)/paths.chords);
+  end=paths.length[ducks->path[j]]<<PATH_PHASE_SHIFT;
+  phase=ducks->phase[j]-paths.step+(int)((Sint64)paths.step*c/paths.chords);
+  if(phase<0) phase=paths.loop[ducks->path[j]] ? phase+end : 0;
+  *y=ducks->offset[j]+path_y(ducks->path[j], phase);
+}
+
+int sweep_duck(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int j, int c, Sint64 *num, Sint64 *den)
+{
+  int bx0, by0, bx1, by1, dx0, dy0, dx1, dy1;
+  Sint64 start, end;
+  
+  // Not fired yet
+  if(c < bullets->fire_chord[i]) return 0;
+  
+  bx1=bullets->prev_x[i]+(int)((Sint64)(bullets->x[i]-bullets->prev_x[i])*(c+1)/paths.chords);
+  by1=bullets->prev_y[i]+(int)((Sint64)(bullets->y[i]-bullets->prev_y[i])*(c+1)/paths.chords);
+  
+  // Shot earlier in the pass, it hangs where it was hit from then on.
+  // Hit time in 1/2^24 of the tick
+  if(grid.shot_den[j] != 0)
+  {
+    bx0=bullets->prev_x[i]+(int)((bullets->x[i]-bullets->prev_x[i])*grid.shot_num[j]/grid.shot_den[j]);
+    by0=bullets->prev_y[i]+(int)((bullets->y[i]-bullets->prev_y[i])*grid.shot_num[j]/grid.shot_den[j]);
+    if(!sweep_box(bx0-ducks->x[j], by0-ducks->offset[j], bx1-bx0, by1-by0,
+		  TO_FIXED(duck_width), TO_FIXED(duck_height), num, den)) return 0;
+    start=(grid.shot_num[j]<<24)/grid.shot_den[j];
+    end=((Sint64)(c+1)<<24)/paths.chords;
+    *num=start+(end-start) * *num / *den;
+    *den=(Sint64)1<<24;
+    return 1;
+  }
+  
+  // Bullet motion relative to the duck during base tick c of the tick,
+  // from the duck corner at its start. Hit time as a fraction of the
+  // whole tick
+  duck_corner(ducks, j, c, &dx0, &dy0);
+  duck_corner(ducks, j, c+1, &dx1, &dy1);
+  bx0=bullets->prev_x[i]+(int)((Sint64)(bullets->x[i]-bullets->prev_x[i])*c/paths.chords);
+  by0=bullets->prev_y[i]+(int)((Sint64)(bullets->y[i]-bullets->prev_y[i])*c/paths.chords);
+  if(!sweep_box(bx0-dx0, by0-dy0, bx1-bx0-(dx1-dx0), by1-by0-(dy1-dy0),
+		TO_FIXED(duck_width), TO_FIXED(duck_height), num, den)) return 0;
+  *num+=c * *den;
+  *den*=paths.chords;
+  return 1;
+}
+
+void duck_hit(int j, int i, Sint64 num, Sint64 den)
+{
+  // Only the earliest hit of a round stops the duck
+  if(grid.hit_den[j]==0)
+  {
+    grid.hit_ducks[grid.hits++]=j;
+  }
+  else if(num*grid.hit_den[j] >= grid.hit_num[j]*den)
+  {
+    return;
+  }
+  grid.hit_num[j]=num;
+  grid.hit_den[j]=den;
+  grid.hit_bullet[j]=i;
+}
+
+void duck_shoot(struct duck_pool *ducks, int j, Sint64 num, Sint64 den)
+{
+  int c, x0, y0, x1, y1;
+  Sint64 part, before;
+  
+  // Stopped where the bullet met it, num/den into the tick, unless it
+  // already hangs from an earlier hit
+  if(grid.shot_den[j]==0)
+  {
+    c=(int)(num*paths.chords/den);
+    part=num*paths.chords-c*den;
+    duck_corner(ducks, j, c, &x0, &y0);
+    duck_corner(ducks, j, c+1, &x1, &y1);
+    ducks->x[j]=x0+(int)((x1-x0)*part/den);
+    ducks->offset[j]=y0+(int)((y1-y0)*part/den);
+    grid.shot_ducks[grid.shots++]=j;
+  }
+  grid.shot_num[j]=num;
+  grid.shot_den[j]=den;
+  
+  // Already that far into the fall path from there. It counts from the
+  // start of the base tick the duck was shot in, which the path it was
+  // on tells, so its samples are reached at base ticks whatever the
+  // tick rate
+  before=paths.step*num/den;
+  ducks->phase[j]=(int)(paths.step-before + ((ducks->phase[j]-paths.step+before) & ((1<<PATH_PHASE_SHIFT)-1)));
+  ducks->vx[j]=0;
+  ducks->vy[j]=0;
+  ducks->path[j]=PATH_FALL;
+  ducks->y[j]=ducks->offset[j]+path_y(PATH_FALL, ducks->phase[j]);
+  ducks->shoot_time[j]=frames;
+}
+
+int collide_round(struct bullet_pool *bullets, struct duck_pool *ducks, int c,
+		  int (*find_duck)(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den))
+{
+  int i, j, k, hits;
+  Sint64 num, den;
+  
+  // First duck each live bullet meets, the earliest bullet of each duck
+  // shoots it
+  for(i=0; i<bullets->count; i++)
+  {
+    j=find_duck(bullets, i, ducks, c, &num, &den);
+    if(j>=0)
+    {
+      duck_hit(j, i, num, den);
+    }
+  }
+  for(k=0; k<grid.hits; k++)
+  {
+    j=grid.hit_ducks[k];
+    duck_shoot(ducks, j, grid.hit_num[j], grid.hit_den[j]);
+    hunters[bullets->player[grid.hit_bullet[j]]].score++;
+    bullets->enabled[grid.hit_bullet[j]]=0;
+    grid.hit_den[j]=0;
+  }
+  hits=grid.hits;
+  grid.hits=0;
+  bullet_remove_disabled(bullets);
+  return hits;
+}
+
+void collide(struct bullet_pool *bullets, struct duck_pool *ducks,
+	     int (*find_duck)(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den))
+{
+  int c, k;
+  
+  // A pass per base tick the tick spans, ducks hit fall from the next
+  // one on. Bullets that lost a duck to an earlier one look again, until
+  // a round hits nothing
+  for(c=0; c<paths.chords; c++)
+  {
+    while(collide_round(bullets, ducks, c, find_duck) > 0);
+    for(k=0; k<grid.shots; k++)
+    {
+      grid.shot_den[grid.shot_ducks[k]]=0;
+    }
+    grid.shots=0;
+  }
+}
+
+void check_collisions(struct bullet_pool *bullets, struct duck_pool *ducks)
+{
+  grid_build(ducks);
+  collide(bullets, ducks, grid_find_duck);
+}
+
+unsigned int state_checksum()
+{
+  unsigned int checksum;
+  int i;
+  
+  // Everything a tick reads or writes, order matters
+  // The first two hunters always count, as before more players existed
+  checksum=frames;
+  for(i=0; hunters != NULL && (i<2 || i<players); i++)
+  {
+    checksum=checksum*31+hunters[i].score;
+    checksum=checksum*31+shotgun[i].magazine;
+    checksum=checksum*31+shotgun[i].cocking_time;
+  }
+  for(i=0; i<ducks.size; i++)
+  {
+    checksum=checksum*31+ducks.x[i];
+    checksum=checksum*31+ducks.y[i];
+    checksum=checksum*31+ducks.vx[i];
+    checksum=checksum*31+ducks.vy[i];
+    checksum=checksum*31+ducks.enabled[i];
+    checksum=checksum*31+ducks.shoot_time[i];
+  }
+  checksum=checksum*31+bullets.count;
+  for(i=0; i<bullets.count; i++)
+  {
+    checksum=checksum*31+bullets.x[i];
+    checksum=checksum*31+bullets.y[i];
+  }
+  checksum=checksum*31+players;
+  checksum=checksum*31+game_over;
+  return checksum;
+}
+
+#ifndef HEADLESS
+void render()
+{
+  SDL_Rect sdl_rect;
+  SDL_Color sdl_color;
+  int i,sprite;
+  char render_time_s[64];
+  struct sized_texture *texture_game_over;
+  struct game_snapshot *game;
+  
+  // Draw the state the simulation published, not the live one
+  game=view->game;
+  
+  // Filtered scaling is an effect the governor may turn off
+  if(textures_effects != render_effects)
+  {
+    SDL_SetTextureScaleMode(texture_background.texture, render_effects ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+    SDL_SetTextureScaleMode(sprite_atlas.texture, render_effects ? SDL_ScaleModeLinear : SDL_ScaleModeNearest);
+    textures_effects = render_effects;
+    static_layer.dirty = 1;
+  }
+  
+  // Background and hunters, redrawn when the players change
+  if(static_layer_players != view->players)
+  {
+    static_layer.dirty = 1;
+  }
+  if(layer_begin(&static_layer, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0))
+  {
+    render_static_layer(game);
+    layer_end(&static_layer);
+  }
+  layer_draw(&static_layer);
+  
+  // Batch ducks
+  sprite=SPRITE_DUCK_FLY;
+  for(i=0; i<game->ducks.size; i++)
+  {
+    if(game->ducks.enabled[i])
+    {
+      if(game->ducks.vx[i]!=0)
+      {
+	sprite=SPRITE_DUCK_FLY+view->frames/sim_ticks(10)%3;
+      }
+      else if(game->ducks.vx[i]==0 && game->ducks.vy[i]==0)
+      {
+	sprite=SPRITE_DUCK_SHOT;
+      }
+      else if(game->ducks.vx[i]==0 && game->ducks.vy[i]>0)
+      {
+	sprite=SPRITE_DUCK_FALL;
+      }
+      sdl_rect.x=FROM_FIXED(interpolate(game->ducks.prev_x[i], game->ducks.x[i]));
+      sdl_rect.y=FROM_FIXED(interpolate(game->ducks.prev_y[i], game->ducks.y[i]));
+      sdl_rect.w=duck_width;
+      sdl_rect.h=duck_height;
+      batch_add_quad(&sprite_batch, sprite_atlas.texture, &sprite_atlas.entries[sprite].rect, &sdl_rect, color_white, game->ducks.vx[i]>0 ? SDL_FLIP_NONE : SDL_FLIP_HORIZONTAL);
+    }
+  }
+  
+  // Render every duck at once
+  batch_flush(&sprite_batch);
+  
+  // Render fired bullets
+  if(bullet_rects_capacity < game->bullets.capacity)
+  {
+    bullet_rects_capacity=game->bullets.capacity;
+    bullet_rects=realloc(bullet_rects, bullet_rects_capacity*sizeof(SDL_Rect));
+    if(bullet_rects==NULL)
+    {
+      printf("Unable to allocate %d bullet rects\n", bullet_rects_capacity);
+      exit(-1);
+    }
+  }
+  for(i=0; i<game->bullets.count; i++)
+  {
+    bullet_rects[i].x=FROM_FIXED(interpolate(game->bullets.prev_x[i], game->bullets.x[i]));
+    bullet_rects[i].y=FROM_FIXED(interpolate(game->bullets.prev_y[i], game->bullets.y[i]));
+    bullet_rects[i].w=4;
+    bullet_rects[i].h=4;
+  }
+  if(game->bullets.count>0)
+  {
+    SDL_SetRenderDrawColor(sdl_renderer, 0x00, 0x00, 0x00, 0xFF );
+    SDL_RenderFillRects(sdl_renderer, bullet_rects, game->bullets.count);
+  }
+  
+  // Counters, magazines and scores, redrawn when one of them changes
+  if(hud_players != view->players)
+  {
+    hud_layer.dirty = 1;
+  }
+  for(i=0; i<view->players; i++)
+  {
+    if(hud_score[i] != game->hunters[i].score || hud_magazine[i] != game->magazine[i])
+    {
+      hud_layer.dirty = 1;
+    }
+  }
+  if(layer_begin(&hud_layer, 0, SCREEN_HEIGHT-HUD_HEIGHT, SCREEN_WIDTH, HUD_HEIGHT, 1))
+  {
+    render_hud_layer(game);
+    layer_end(&hud_layer);
+  }
+  layer_draw(&hud_layer);
+  
+  sdl_color=color_black;
+  
+  // Draw render time
+  if(show_overlay)
+  {
+    if(telemetry.cpus > 0)
+    {
+      sprintf(render_time_s, "%ums %2.1fC %dMHz%s", render_time, temperature, telemetry.cpu_khz[0]/1000,
+	      telemetry.throttled > 0 ? " throttled" : "");
+    }
+    else
+    {
+      sprintf(render_time_s, "%ums %2.1fC", render_time, temperature);
+    }
+    draw_text(&atlas_roboto, render_time_s,
+	      SCREEN_WIDTH-text_width(&atlas_roboto, render_time_s)-5,
+	      SCREEN_HEIGHT-atlas_roboto.line_height-5, sdl_color);
+  }
+  
+  // Render game game  over
+  if(view->game_over)
+  {
+    texture_game_over=get_static_text(font_big, "GAME OVER", sdl_color);
+    sdl_rect.x=SCREEN_WIDTH/2-texture_game_over->width/2;
+    sdl_rect.y=SCREEN_HEIGHT/2-texture_game_over->height/2;
+    sdl_rect.w=texture_game_over->width;
+    sdl_rect.h=texture_game_over->height;  
+    SDL_RenderCopy(sdl_renderer, texture_game_over->texture, NULL, &sdl_rect);
+  }
+  
+  // Render pause
+  if(view->pause)
+  {
+    texture_game_over=get_static_text(font_big, "PAUSE", sdl_color);
+    sdl_rect.x=SCREEN_WIDTH/2-texture_game_over->width/2;
+    sdl_rect.y=SCREEN_HEIGHT/2-texture_game_over->height/2;
+    sdl_rect.w=texture_game_over->width;
+    sdl_rect.h=texture_game_over->height;  
+    SDL_RenderCopy(sdl_renderer, texture_game_over->texture, NULL, &sdl_rect);
+  }
+  
+}
+
+void render_static_layer(struct game_snapshot *game)
+{
+  SDL_Rect sdl_rect;
+  int i;
+  
+  // Render background
+  SDL_RenderCopy(sdl_renderer, texture_background.texture, NULL, NULL);
+  
+  // Batch hunters, the ones on the right face left
+  sdl_rect.w=hunter_width;
+  sdl_rect.h=hunter_height;
+  for(i=0; i<view->players; i++)
+  {
+    sdl_rect.x=game->hunters[i].x;
+    sdl_rect.y=game->hunters[i].y;
+    batch_add_quad(&sprite_batch, sprite_atlas.texture, &sprite_atlas.entries[SPRITE_HUNTER].rect, &sdl_rect, color_white,
+		   i%2 ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE);
+  }
+  batch_flush(&sprite_batch);
+  
+  static_layer_players=view->players;
+}
+
+void render_hud_layer(struct game_snapshot *game)
+{
+  SDL_Rect sdl_rect;
+  int i,j,offset,spacing,compact;
+  char score_s[12];
+  
+  // Even players from the left, odd ones from the right, inwards. Each
+  // side shares half the strip
+  spacing=(SCREEN_WIDTH/2)/((view->players+1)/2);
+  compact=spacing < HUD_ENTRY_WIDTH;
+  
+  // Coordinates are relative to the strip, its bottom is the screen bottom
+  // Batch ducks counters
+  sdl_rect.y=HUD_HEIGHT - DUCK_HEIGHT - 10;
+  sdl_rect.w=DUCK_WIDTH;
+  sdl_rect.h=DUCK_HEIGHT;
+  for(j=0; !compact && j<view->players; j++)
+  {
+    offset=j/2*spacing;
+    sdl_rect.x=j%2==0 ? 60+offset : SCREEN_WIDTH-200-offset;
+    batch_add_quad(&sprite_batch, sprite_atlas.texture, &sprite_atlas.entries[SPRITE_DUCK_FLY].rect, &sdl_rect, color_white, SDL_FLIP_NONE);
+  }
+  
+  // Batch bullets remaining
+  sdl_rect.w=sprite_atlas.entries[SPRITE_BULLET].rect.w;
+  sdl_rect.h=sprite_atlas.entries[SPRITE_BULLET].rect.h;
+  sdl_rect.y=HUD_HEIGHT - sdl_rect.h-10;
+  for(j=0; j<view->players; j++)
+  {
+    offset=j/2*spacing;
+    for(i=0; i<game->magazine[j]; i++)
+    {    
+      if(j%2==0)
+      {
+	sdl_rect.x=offset+10*i;
+      }
+      else
+      {
+	sdl_rect.x=SCREEN_WIDTH-25-offset-10*i;
+      }
+      batch_add_quad(&sprite_batch, sprite_atlas.texture, &sprite_atlas.entries[SPRITE_BULLET].rect, &sdl_rect, color_white, SDL_FLIP_NONE);
+    }
+  }
+  batch_flush(&sprite_batch);
+  
+  // Render scores
+  for(j=0; j<view->players; j++)
+  {
+    offset=j/2*spacing;
+    sprintf(score_s, "%02d", game->hunters[j].score);
+    if(compact)
+    {
+      // Score takes the place of the counter, next to the shells
+      draw_text(&atlas_small, score_s, j%2==0 ? 50+offset : SCREEN_WIDTH-100-offset, HUD_HEIGHT - 49, color_black);
+    }
+    else
+    {
+      draw_text(&atlas_small, score_s, j%2==0 ? 100+offset : SCREEN_WIDTH-150-offset, HUD_HEIGHT - 49, color_black);
+    }
+  }
+  
+  hud_players=view->players;
+  for(j=0; j<view->players; j++)
+  {
+    hud_score[j]=game->hunters[j].score;
+    hud_magazine[j]=game->magazine[j];
+  }
+}
+
+void save_snapshot(struct snapshot *snapshot)
+{
+  struct game_snapshot *game;
+  int i;
+  
+  // Runs on the simulation thread, the slot is not being drawn
+  if(snapshot->game == NULL)
+  {
+    snapshot->game=calloc(1, sizeof(struct game_snapshot));
+    if(snapshot->game == NULL)
+    {
+      printf("Unable to allocate a snapshot\n");
+      exit(-1);
+    }
+  }
+  game=snapshot->game;
+  
+  // Nothing to copy in the menu before the first round
+  if(hunters != NULL)
+  {
+    memcpy(game->hunters, hunters, players_max*sizeof(struct hunter));
+    for(i=0; i<players_max; i++)
+    {
+      game->magazine[i]=shotgun[i].magazine;
+    }
+  }
+  
+  // Ducks
+  if(game->ducks.capacity < ducks.size)
+  {
+    duck_pool_alloc(&game->ducks, ducks.capacity, NULL);
+  }
+  game->ducks.size=ducks.size;
+  memcpy(game->ducks.x, ducks.x, ducks.size*sizeof(int));
+  memcpy(game->ducks.y, ducks.y, ducks.size*sizeof(int));
+  memcpy(game->ducks.prev_x, ducks.prev_x, ducks.size*sizeof(int));
+  memcpy(game->ducks.prev_y, ducks.prev_y, ducks.size*sizeof(int));
+  memcpy(game->ducks.vx, ducks.vx, ducks.size*sizeof(int));
+  memcpy(game->ducks.vy, ducks.vy, ducks.size*sizeof(int));
+  memcpy(game->ducks.enabled, ducks.enabled, ducks.size*sizeof(int));
+  
+  // Live bullets
+  if(game->bullets.capacity < bullets.count)
+  {
+    bullet_pool_alloc(&game->bullets, bullets.capacity, NULL);
+  }
+  game->bullets.count=bullets.count;
+  memcpy(game->bullets.x, bullets.x, bullets.count*sizeof(int));
+  memcpy(game->bullets.y, bullets.y, bullets.count*sizeof(int));
+  memcpy(game->bullets.prev_x, bullets.prev_x, bullets.count*sizeof(int));
+  memcpy(game->bullets.prev_y, bullets.prev_y, bullets.count*sizeof(int));
+}
+
+void free_snapshot(struct snapshot *snapshot)
+{
+  if(snapshot->game != NULL)
+  {
+    duck_pool_free(&snapshot->game->ducks);
+    bullet_pool_free(&snapshot->game->bullets);
+    free(snapshot->game);
+    snapshot->game=NULL;
+  }
+}
+#endif
+
+void process_axis(int controller, int axis, int value)
+{
+}
+
+void process_button_down(int controller, int button)
+{
+  switch(button) 
+  {
+    // Fire
+    case BUTTON_A: case BUTTON_R1: case BUTTON_R2: fire(controller); break;
+    case BUTTON_X: fire(controller+1); break;
+    case BUTTON_Y: cock(controller+1); break;
+    // Reload
+    case BUTTON_B: case BUTTON_L1: cock(controller); break;
+    case BUTTON_SELECT: process_select_button(); break;
+    case BUTTON_START: process_start_button(); break;    
+  }
+}
+void process_button_up(int controller, int button)
+{
+}
+
+
+void fire(int player)
+{
+  int i;
+  
+  // No round carved yet while the first menu is shown
+  if(game_over || shotgun == NULL) return;
+  
+  // Controllers without a player, or the second player of a single one
+  if(player >= players) return;
+  
+  // Reloaded at the start of the tick, usable from the time it ends
+  if(shotgun[player].magazine>0 && !(frames == shotgun[player].cocking_time && input_phase < shotgun[player].cocking_phase))
+  {
+    // Take a free slot, nothing is fired when the pool is full
+    i=bullet_spawn(&bullets);
+    if(i>=0)
+    {
+      bullets.y[i]=TO_FIXED(hunters[player].y);
+      bullets.player[i]=player;
+      // Even players stand on the left and shoot right
+      if(player%2==0)
+      {
+	bullets.x[i]=TO_FIXED(hunters[player].x + hunter_width);
+	bullets.vx[i]=bullet_vx;
+      }
+      else
+      {
+	bullets.x[i]=TO_FIXED(hunters[player].x);
+	bullets.vx[i]=-bullet_vx;
+      }
+      bullets.vy[i]=bullet_vy;
+      // Pressed part way through the tick, it travels only the rest of it
+      bullets.x[i]-=bullets.vx[i]*input_phase/INPUT_PHASES;
+      bullets.y[i]-=bullets.vy[i]*input_phase/INPUT_PHASES;
+      bullets.fire_chord[i]=input_phase*paths.chords/INPUT_PHASES;
+      bullets.prev_x[i]=bullets.x[i];
+      bullets.prev_y[i]=bullets.y[i];
+      shotgun[player].magazine--;
+      play_sound(fire_chunk, voices_shots);
+    }
+  }
+  else
+  {
+    play_sound(fire_dry_chunk, voices_shots);
+  }
+}
+
+void cock(int player)
+{
+  if(game_over || shotgun == NULL || player >= players) return;
+  shotgun[player].magazine=0;
+  play_sound(cocking_chunk, voices_reload);
+  shotgun[player].cocking_time=frames+sim_ticks(30);
+  shotgun[player].cocking_phase=input_phase;
+}
+
+void process_start_button()
+{
+  if(game_over)
+  {
+    game_over=0;
+    pause=0;
+    init_game();
+  }
+  else
+  {
+    pause=!pause;
+  }
+}
+
+void process_select_button()
+{
+}
+
+void autoplay(unsigned int tick)
+{
+  int i;
+  
+  // Fire at a steady pace, reload when empty
+  for(i=0; i<players; i++)
+  {
+    if(shotgun[i].magazine>0 && (tick+i)%fire_interval == 0)
+    {
+      process_button_down(i, BUTTON_A);
+    }
+    else if(shotgun[i].magazine==0 && shotgun[i].cocking_time<=frames)
+    {
+      process_button_down(i, BUTTON_B);
+    }
+  }
+}
+
+#ifndef HEADLESS
+void bench_round(const struct bench_scenario *scenario)
+{
+  int i;
+  
+  game_over=0;
+  pause=0;
+  players_menu=scenario->menu;
+  init_game();
+  if(!scenario->scatter) return;
+  
+  // Whole flock on screen at once, above the hunters
+  for(i=0; i<ducks.size; i++)
+  {
+    ducks.x[i]=TO_FIXED(rand()%(SCREEN_WIDTH-duck_width));
+    ducks.offset[i]=TO_FIXED(rand()%(SCREEN_HEIGHT/2));
+    ducks.y[i]=ducks.offset[i]+path_y(ducks.path[i], ducks.phase[i]);
+    ducks.prev_x[i]=ducks.x[i];
+    ducks.prev_y[i]=ducks.y[i];
+    ducks.vx[i]=i%2 ? -duck_speed : duck_speed;
+  }
+}
+
+void run_bench()
+{
+  static const struct bench_scenario scenarios[] =
+  {
+    {"menu", 1, FLOCK_SIZE, 8, 0, 1},
+    {"round_1p", 1, FLOCK_SIZE, 8, 0, 0},
+    {"round_2p", 2, FLOCK_SIZE, 8, 0, 0},
+    {"rapid_fire", 2, FLOCK_SIZE, 0, 0, 0},
+    {"flock_1000", 2, 500, 8, 1, 0},
+    {"flock_8000", 2, 4000, 8, 1, 0}
+  };
+  const struct bench_scenario *scenario;
+  struct bench_samples update_samples, collision_samples, render_samples;
+  Uint64 start, end;
+  int s, i, p, k, flock, interval, timed;
+  
+  memset(&update_samples, 0, sizeof(update_samples));
+  memset(&collision_samples, 0, sizeof(collision_samples));
+  memset(&render_samples, 0, sizeof(render_samples));
+  update_samples.name="update";
+  collision_samples.name="collisions";
+  render_samples.name="render";
+  flock=flock_size;
+  interval=fire_interval;
+  
+  for(s=0; s<(int)(sizeof(scenarios)/sizeof(scenarios[0])); s++)
+  {
+    scenario=&scenarios[s];
+    if(bench_scenario != NULL && strcmp(bench_scenario, scenario->name) != 0) continue;
+    
+    // Same rounds every run
+    srand(1);
+    players=scenario->players;
+    flock_size=scenario->flock;
+    fire_interval=scenario->fire_interval > 0 ? scenario->fire_interval : 1;
+    bench_round(scenario);
+    
+    for(i=0; i<BENCH_WARMUP+bench_iterations; i++)
+    {
+      timed = i >= BENCH_WARMUP;
+      if(game_over)
+      {
+	bench_round(scenario);
+      }
+      
+      // Selection moves every few frames, nothing to simulate
+      if(scenario->menu)
+      {
+	players=1+i/10%players_max;
+      }
+      // Inputs, not timed
+      else if(scenario->fire_interval > 0)
+      {
+	autoplay(i);
+      }
+      else
+      {
+	// Rapid fire: every shell of every magazine, the pool saturates
+	for(p=0; p<players; p++)
+	{
+	  shotgun[p].magazine=MAGAZINE_SIZE;
+	  for(k=0; k<MAGAZINE_SIZE; k++)
+	  {
+	    fire(p);
+	  }
+	}
+      }
+      
+      // One tick, collisions timed inside it
+      if(!scenario->menu)
+      {
+	bench_collisions = timed ? &collision_samples : NULL;
+	frames++;
+	start=SDL_GetPerformanceCounter();
+	update_game();
+	end=SDL_GetPerformanceCounter();
+	bench_collisions = NULL;
+	if(timed)
+	{
+	  bench_add(&update_samples, start, end);
+	}
+      }
+      
+      // Draw the tick, present included as draw calls are only
+      // submitted there
+      snapshot_publish();
+      snapshot_acquire();
+      render_alpha=1.0;
+      start=SDL_GetPerformanceCounter();
+      begin_frame();
+      if(view->players_menu)
+      {
+	render_menu();
+      }
+      else
+      {
+	render();
+      }
+      end_frame();
+      SDL_RenderPresent(sdl_renderer);
+      end=SDL_GetPerformanceCounter();
+      if(timed)
+      {
+	bench_add(&render_samples, start, end);
+      }
+      frame_hash_write(scenario->name, i);
+    }
+    
+    bench_record(scenario->name, &update_samples);
+    bench_record(scenario->name, &collision_samples);
+    bench_record(scenario->name, &render_samples);
+  }
+  
+  players_menu=0;
+  flock_size=flock;
+  fire_interval=interval;
+  free(update_samples.ticks);
+  free(collision_samples.ticks);
+  free(render_samples.ticks);
+}
+#endif
+
+int process_arg(int argc, char* args[], int i)
+{
+  if(strcmp(args[i], "--simd")==0 && i+1<argc)
+  {
+    simd_kernels=args[i+1];
+    return 2;
+  }
+#ifndef HEADLESS
+  if(strcmp(args[i], "--no-atlas-cache")==0)
+  {
+    sprite_atlas_cache=NULL;
+    return 1;
+  }
+#endif
+  if(strcmp(args[i], "--flock")==0 && i+1<argc)
+  {
+    flock_size=atoi(args[i+1]);
+    if(flock_size < 1)
+    {
+      printf("A flock needs at least one duck\n");
+      exit(-1);
+    }
+    return 2;
+  }
+  if(strcmp(args[i], "--bullets")==0 && i+1<argc)
+  {
+    bullets_capacity=atoi(args[i+1]);
+    if(bullets_capacity < 1)
+    {
+      printf("Bullet pool needs at least one slot\n");
+      exit(-1);
+    }
+    return 2;
+  }
+  return 0;
+}
+
+void save_game_options(Uint32 *options)
+{
+  options[0]=flock_size;
+  options[1]=bullets_capacity;
+}
+
+void load_game_options(const Uint32 *options)
+{
+  if(options[0] < 1 || options[1] < 1)
+  {
+    printf("Input log has no ducks or no bullets\n");
+    exit(-1);
+  }
+  flock_size=options[0];
+  bullets_capacity=options[1];
 }
 
-void close_media()
+void print_game_options()
 {
-  // Free sound effects
-  Mix_FreeChunk(fire_chunk);
-  Mix_FreeChunk(fire_dry_chunk);
-  Mix_FreeChunk(cocking_chunk);
-  Mix_FreeChunk(quack_chunk);
-  
-  // Destroy textures
-  SDL_DestroyTexture(texture_background.texture);
-  SDL_DestroyTexture(texture_hunter.texture);
-  SDL_DestroyTexture(texture_bulllet.texture);
-  SDL_DestroyTexture(texture_sprites.texture);
+  printf(" [--simd scalar|sse2|avx2|neon] [--bullets pool_capacity] [--flock ducks_per_player]");
+#ifndef HEADLESS
+  printf(" [--no-atlas-cache]");
+#endif
 }
 
-void init_game()
+#ifdef HEADLESS
+/** HEADLESS SIMULATION **/
+// hunter.png size, used instead of the loaded texture
+#define HUNTER_WIDTH 100
+#define HUNTER_HEIGHT 196
+// A round that runs longer than this is aborted
+#define MAX_ROUND_TICKS 1000000
+// Most tick rates a rate check compares
+#define MAX_CHECK_RATES 8
+
+struct script_event
+{
+  unsigned int tick;
+  int controller;
+  int button;
+};
+
+// Scripted inputs, ticks relative to round start
+struct script_event *script;
+int script_size;
+
+// Tick rates the same rounds are played at by the rate check
+int check_rates[MAX_CHECK_RATES];
+int check_rates_count;
+
+void load_script(char *path);
+void scripted_input(unsigned int tick);
+int brute_find_duck(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den);
+void check_collisions_brute(struct bullet_pool *bullets, struct duck_pool *ducks);
+void reload_bullets(struct bullet_pool *bullets, int *x, int *y, int n);
+void reload_ducks(struct duck_pool *ducks, struct duck_pool *saved);
+void run_collision_bench();
+void run_rate_check(unsigned int rounds);
+
+void load_script(char *path)
 {
-  int i,j;
+  FILE *file;
+  struct script_event event;
+  int capacity;
   
-  if(SCREEN_HEIGHT>600)
-  {
-    hunter_height=2*texture_hunter.height;
-    hunter_width=2*texture_hunter.width;
-    duck_height=2*DUCK_HEIGHT;
-    duck_width=2*DUCK_WIDTH;
-    speed_bullet=2*SPEED_BULLET;
-  }
-  else
+  file = fopen(path, "r");
+  if(file == NULL)
   {
-    hunter_height=texture_hunter.height;
-    hunter_width=texture_hunter.width;
-    duck_height=DUCK_HEIGHT;
-    duck_width=DUCK_WIDTH;
-    speed_bullet=SPEED_BULLET;
+    printf("Unable to open script %s\n", path);
+    exit(-1);
   }
   
-  hunters[0].x=10;
-  hunters[1].x=SCREEN_WIDTH-110;
-  hunters[0].y=SCREEN_HEIGHT-hunter_height-40;
-  hunters[1].y=hunters[0].y;
-  hunters[0].score=0;
-  hunters[1].score=0;
-  shotgun[0].magazine=MAGAZINE_SIZE;
-  shotgun[0].cocking_time=0;
-  shotgun[1].magazine=MAGAZINE_SIZE;
-  shotgun[1].cocking_time=0;
-  
-  // Init bullets
-  for(i=0; i<BULLETS_SIZE; i++)
+  // One "tick controller button" event per line
+  capacity=0;
+  script_size=0;
+  while(fscanf(file, "%u %d %d", &event.tick, &event.controller, &event.button) == 3)
   {
-    bullets[i].enabled=0;
+    if(script_size == capacity)
+    {
+      capacity = capacity ? capacity*2 : 64;
+      script = realloc(script, capacity*sizeof(struct script_event));
+    }
+    script[script_size++]=event;
   }
+  fclose(file);
+}
+
+void scripted_input(unsigned int tick)
+{
+  int i;
   
-  // init ducks
-  ducks_size=10;
-  for(i=0; i<10; i++)
+  if(script_size>0)
   {
-    ducks[i].x=DUCK_START_X-300*i-200*(i%2);
-    ducks[i].y=50+50*(i%2);
-    ducks[i].vx=DUCK_SPEED;
-    ducks[i].vy=0;
-    ducks[i].shoot_time=0;
-    ducks[i].enabled=1;
+    for(i=0; i<script_size; i++)
+    {
+      if(script[i].tick == tick)
+      {
+	process_button_down(script[i].controller, script[i].button);
+      }
+    }
+    return;
   }
-  if(players==2)
+  
+  // No script given
+  autoplay(tick);
+}
+
+int brute_find_duck(struct bullet_pool *bullets, int i, struct duck_pool *ducks, int c, Sint64 *num, Sint64 *den)
+{
+  int j, found;
+  Sint64 hit_num, hit_den;
+  
+  // Every duck, earliest hit, lowest index on a tie
+  found=-1;
+  *num=0;
+  *den=1;
+  for(j=0; j<ducks->size; j++)
   {
-    ducks_size=20;
-    for(i=10,j=0; i<20; i++,j++)
+    if(ducks->enabled[j]
+      && sweep_duck(bullets, i, ducks, j, c, &hit_num, &hit_den)
+      && (found<0 || hit_num * *den < *num * hit_den))
     {
-      ducks[i].x=SCREEN_WIDTH+300*j+200*(j%2);
-      ducks[i].y=20+50*(j%2);
-      ducks[i].vx=-DUCK_SPEED;
-      ducks[i].vy=0;
-      ducks[i].shoot_time=0;
-      ducks[i].enabled=1;
+      found=j;
+      *num=hit_num;
+      *den=hit_den;
     }
   }
+  return found;
+}
+
+void check_collisions_brute(struct bullet_pool *bullets, struct duck_pool *ducks)
+{
+  // Reference all pairs test. The grid only holds the hit storage
+  grid_build(ducks);
+  collide(bullets, ducks, brute_find_duck);
+}
+
+void reload_bullets(struct bullet_pool *bullets, int *x, int *y, int n)
+{
+  int i;
   
+  // Despawning reorders the pool, start every pass from the same bullets
+  memcpy(bullets->x, x, n*sizeof(int));
+  memcpy(bullets->y, y, n*sizeof(int));
+  // Each came up the usual shot angle during the tick
+  for(i=0; i<n; i++)
+  {
+    bullets->prev_x[i]=x[i]-bullet_vx;
+    bullets->prev_y[i]=y[i]-bullet_vy;
+  }
+  memset(bullets->player, 0, n*sizeof(int));
+  memset(bullets->fire_chord, 0, n*sizeof(int));
+  bullets->count=n;
 }
 
-void update_game()
+void reload_ducks(struct duck_pool *ducks, struct duck_pool *saved)
 {
-  int i,j, all_ducks_disabled;
+  int n;
   
-  if(game_over || pause) return;
+  // Updates and hits move the flock, start every pass from the same one
+  n=saved->size;
+  memcpy(ducks->x, saved->x, n*sizeof(int));
+  memcpy(ducks->y, saved->y, n*sizeof(int));
+  memcpy(ducks->vx, saved->vx, n*sizeof(int));
+  memcpy(ducks->vy, saved->vy, n*sizeof(int));
+  memcpy(ducks->enabled, saved->enabled, n*sizeof(int));
+  memcpy(ducks->path, saved->path, n*sizeof(int));
+  memcpy(ducks->phase, saved->phase, n*sizeof(int));
+  memcpy(ducks->offset, saved->offset, n*sizeof(int));
+  memcpy(ducks->prev_x, saved->prev_x, n*sizeof(int));
+  memcpy(ducks->prev_y, saved->prev_y, n*sizeof(int));
+  memcpy(ducks->shoot_time, saved->shoot_time, n*sizeof(unsigned int));
+  ducks->size=n;
+}
+
+void run_collision_bench()
+{
+  // Flock sizes, bullets grow with ducks
+  static const int sizes[] = {250, 500, 1000, 2000, 4000, 8000, 16000, 32000};
+  struct duck_pool bench_ducks, flock;
+  struct bullet_pool bench_bullets;
+  Uint64 start, update_time, grid_time, brute_time;
+  int *fired_x, *fired_y;
+  int s, i, n, iterations, grid_hits, brute_hits;
+  
+  texture_hunter.width=HUNTER_WIDTH;
+  texture_hunter.height=HUNTER_HEIGHT;
+  memset(&bench_ducks, 0, sizeof(bench_ducks));
+  memset(&flock, 0, sizeof(flock));
+  memset(&bench_bullets, 0, sizeof(bench_bullets));
   
-  // update ducks
-  for(i=0; i<ducks_size; i++)
+  printf("[\n");
+  for(s=0; s<(int)(sizeof(sizes)/sizeof(sizes[0])); s++)
   {
-    // Update ducks speed
+    n=sizes[s];
     
-    // Set speed to 0 to outscreen ducks
-    if(ducks[i].y>SCREEN_HEIGHT)
-    {
-      ducks[i].enabled=0;
-      ducks[i].vx=0;
-      ducks[i].vy=0;
-    }
-    // Disable outscreen ducks
-    if(ducks[i].vx>0 && ducks[i].x>SCREEN_WIDTH)
+    // Keep flock density of a 2 player round (20 ducks on 1024x600)
+    SCREEN_WIDTH=(int)(1024*sqrt(n/20.0));
+    SCREEN_HEIGHT=(int)(600*sqrt(n/20.0));
+    init_game();
+    
+    duck_pool_alloc(&bench_ducks, n, NULL);
+    duck_pool_alloc(&flock, n, NULL);
+    bullet_pool_alloc(&bench_bullets, n, NULL);
+    fired_x=malloc(n*sizeof(int));
+    fired_y=malloc(n*sizeof(int));
+    // Flock every pass starts from, each duck a tick into its flight
+    flock.size=n;
+    for(i=0; i<n; i++)
     {
-      ducks[i].enabled=0;
+      flock.enabled[i]=1;
+      flock.x[i]=TO_FIXED(rand()%SCREEN_WIDTH);
+      flock.y[i]=TO_FIXED(rand()%SCREEN_HEIGHT);
+      flock.vx[i]=duck_speed;
+      flock.path[i]=i%PATH_FLIGHTS;
+      flock.phase[i]=(i%PATH_LAP)<<PATH_PHASE_SHIFT;
+      flock.offset[i]=flock.y[i]-path_y(flock.path[i], flock.phase[i]);
+      flock.prev_x[i]=flock.x[i]-duck_speed;
+      flock.prev_y[i]=flock.y[i];
+      fired_x[i]=TO_FIXED(rand()%SCREEN_WIDTH);
+      fired_y[i]=TO_FIXED(rand()%SCREEN_HEIGHT);
+      bench_bullets.enabled[i]=1;
     }
-    // Disable outscreen ducks
-    if(ducks[i].vx<0 && ducks[i].x<0)
+    reload_ducks(&bench_ducks, &flock);
+    reload_bullets(&bench_bullets, fired_x, fired_y, n);
+    
+    // Entity update kernels over the whole flock, which they move and cull
+    iterations = 2000000/n;
+    start=SDL_GetPerformanceCounter();
+    for(i=0; i<iterations; i++)
     {
-      ducks[i].enabled=0;
+      kernels.cull_ducks(bench_ducks.x, bench_ducks.y, bench_ducks.vx, bench_ducks.vy, bench_ducks.enabled, n, TO_FIXED(SCREEN_WIDTH), TO_FIXED(SCREEN_HEIGHT));
+      kernels.follow_paths(&paths, bench_ducks.path, bench_ducks.phase, bench_ducks.offset, bench_ducks.y, bench_ducks.vy, bench_ducks.enabled, n);
+      kernels.integrate(bench_ducks.x, bench_ducks.y, bench_ducks.vx, bench_ducks.vy, NULL, n);
+      kernels.cull_bullets(bench_bullets.x, bench_bullets.y, bench_bullets.enabled, n, TO_FIXED(SCREEN_WIDTH), TO_FIXED(SCREEN_HEIGHT));
+      kernels.integrate(bench_bullets.x, bench_bullets.y, bench_bullets.vx, bench_bullets.vy, NULL, n);
     }
-    // Shot time
-    if(frames == ducks[i].shoot_time)
+    update_time=SDL_GetPerformanceCounter()-start;
+    
+    // Broadphase, repeated to get stable numbers, on the whole flock
+    grid_time=0;
+    for(i=0; i<iterations; i++)
     {
-      ducks[i].vx=0;
-      ducks[i].vy=0;
+      reload_ducks(&bench_ducks, &flock);
+      reload_bullets(&bench_bullets, fired_x, fired_y, n);
+      start=SDL_GetPerformanceCounter();
+      check_collisions(&bench_bullets, &bench_ducks);
+      grid_time+=SDL_GetPerformanceCounter()-start;
     }
-    // 10 frames after shot, the ducks falls
-    if(ducks[i].shoot_time != 0 && frames == ducks[i].shoot_time+10)
+    grid_hits=n-bench_bullets.count;
+    if(grid_hits == 0)
     {
-      ducks[i].vx=0;
-      ducks[i].vy=10;
+      printf("No hits with %d ducks, the broadphase was not exercised\n", n);
+      exit(-1);
     }
     
-    // Update ducks position
-    ducks[i].x+=ducks[i].vx;
-    ducks[i].y+=ducks[i].vy;
-    
-    // Update shotgun status
-    for(j=0; j<2; j++)
+    // All pairs reference, skipped when it gets too slow
+    brute_time=0;
+    brute_hits=-1;
+    if(n<=8000)
     {
-      if(frames == shotgun[j].cocking_time)
+      reload_ducks(&bench_ducks, &flock);
+      reload_bullets(&bench_bullets, fired_x, fired_y, n);
+      start=SDL_GetPerformanceCounter();
+      check_collisions_brute(&bench_bullets, &bench_ducks);
+      brute_time=SDL_GetPerformanceCounter()-start;
+      brute_hits=n-bench_bullets.count;
+      if(brute_hits != grid_hits)
       {
-	shotgun[j].magazine=MAGAZINE_SIZE;
+	printf("Broadphase mismatch: %d hits, reference %d\n", grid_hits, brute_hits);
+	exit(-1);
       }
     }
+    
+    printf("  {\"kernels\": \"%s\", \"ducks\": %d, \"bullets\": %d, \"hits\": %d, \"update_us\": %.2f, \"grid_us\": %.2f, \"grid_ns_per_entity\": %.1f, \"brute_us\": %.2f}%s\n",
+	   kernels.name, n, n, grid_hits, update_time*1e6/perf_frequency/iterations, grid_time*1e6/perf_frequency/iterations,
+	   grid_time*1e9/perf_frequency/iterations/(2*n),
+	   brute_time*1e6/perf_frequency, s<(int)(sizeof(sizes)/sizeof(sizes[0]))-1 ? "," : "");
+    
+    free(fired_x);
+    free(fired_y);
   }
+  printf("]\n");
   
-  // Update bullets
-  for(i=0; i<BULLETS_SIZE; i++)
-  {
-    if(bullets[i].y>SCREEN_HEIGHT || bullets[i].y<0 || bullets[i].x>SCREEN_WIDTH || bullets[i].x<0)
-    {
-      bullets[i].enabled=0;
-    }
-    if(bullets[i].enabled)
-    {
-      bullets[i].x+=bullets[i].vx;
-      bullets[i].y+=bullets[i].vy;
-    }
-  }
+  duck_pool_free(&bench_ducks);
+  duck_pool_free(&flock);
+  bullet_pool_free(&bench_bullets);
+}
+
+void run_rate_check(unsigned int rounds)
+{
+  unsigned int score[MAX_PLAYERS], first[MAX_PLAYERS];
+  unsigned int round, round_start, tick, base, ticks;
+  int r, p, failed;
   
-  // Check collisions
-  for(i=0; i<BULLETS_SIZE; i++)
+  // Same rounds at every rate, autoplay pressing at base ticks so the
+  // inputs happen at the same times whatever the tick rate
+  failed=0;
+  printf("[\n");
+  for(r=0; r<check_rates_count; r++)
   {
-    for(j=0; j<ducks_size; j++)
+    sim_rate=check_rates[r];
+    srand(seed);
+    frames=0;
+    ticks=0;
+    memset(score, 0, sizeof(score));
+    for(round=0; round<rounds; round++)
     {
-      if(bullets[i].enabled && ducks[j].enabled &&
-	bullets[i].x>ducks[j].x && bullets[i].x<ducks[j].x+duck_width
-	&& bullets[i].y>ducks[j].y && bullets[i].y<ducks[j].y+duck_height)
+      game_over=0;
+      init_game();
+      round_start=frames;
+      base=0;
+      while(!game_over && frames-round_start < MAX_ROUND_TICKS)
+      {
+	// Base ticks that start in this tick, at their place in it
+	tick=frames-round_start;
+	while((Uint64)base*sim_rate < (Uint64)(tick+1)*SIM_BASE_RATE)
+	{
+	  input_phase=(int)(((Uint64)base*sim_rate - (Uint64)tick*SIM_BASE_RATE)*INPUT_PHASES/SIM_BASE_RATE);
+	  autoplay(base);
+	  base++;
+	}
+	input_phase=0;
+	frames++;
+	update_game();
+      }
+      ticks+=frames-round_start;
+      for(p=0; p<players; p++)
       {
-	ducks[j].shoot_time=frames+1;
-	hunters[bullets[i].player].score++;
-	bullets[i].enabled=0;
+	score[p]+=hunters[p].score;
       }
     }
-  }
-  
-  // Check if end of game
-  all_ducks_disabled=1;
-  for(i=0; i<ducks_size; i++)
-  {
-    if(ducks[i].enabled)
+    
+    printf("  {\"tick_rate\": %d, \"ticks\": %u, \"scores\": [", sim_rate, ticks);
+    for(p=0; p<players; p++)
     {
-      all_ducks_disabled=0;
-      break;
+      printf(p>0 ? ", %u" : "%u", score[p]);
+      if(r>0 && score[p] != first[p]) failed=1;
     }
+    printf("]}%s\n", r<check_rates_count-1 ? "," : "");
+    if(r==0) memcpy(first, score, sizeof(first));
   }
-  if(all_ducks_disabled)
+  printf("]\n");
+  
+  if(failed)
   {
-    game_over=1;
+    printf("Scores differ between tick rates\n");
+    exit(-1);
   }
 }
 
-void render()
+int main( int argc, char* args[] )
 {
-  SDL_Rect sdl_rect;
-  SDL_Rect sdl_rect2;
-  SDL_Color sdl_color;
-  int i,j;
-  struct sized_texture texture_text_p1;
-  //  struct sized_texture texture_text_p2;
-  char p1_score_s[5];
-  char p2_score_s[5];
-  char render_time_s[10];
-  struct sized_texture texture_game_over;
-  
-  struct sized_texture texture_render_time;
-  
-  //Clear screen
-  SDL_SetRenderDrawColor( sdl_renderer, 0x00, 0x00, 0x00, 0xFF );
-  SDL_RenderClear( sdl_renderer );
+  Uint64 start, end, round_counter;
+  unsigned int rounds, round, round_start, ticks, checksum;
+  unsigned int total_score[MAX_PLAYERS];
+  // Whole rounds, kept apart from the per tick phases
+  struct histogram round_update;
+  double seconds;
+  int i, p, consumed, dump_profile, collision_bench;
+  char *rate;
   
-  // Render background
-  SDL_RenderCopy(sdl_renderer, texture_background.texture, NULL, NULL);
-  
-  // Render hunter
-  sdl_rect.x=hunters[0].x;
-  sdl_rect.y=hunters[0].y;
-  sdl_rect.w=hunter_width;
-  sdl_rect.h=hunter_height;
-  SDL_RenderCopyEx(sdl_renderer, texture_hunter.texture, NULL, &sdl_rect, 0.0, NULL, SDL_FLIP_NONE);
-  
-  // Render hunter p2
-  if(players==2)
-  {
-    sdl_rect.x=hunters[1].x;
-    sdl_rect.y=hunters[1].y;
-    sdl_rect.w=hunter_width;
-    sdl_rect.h=hunter_height;
-    SDL_RenderCopyEx(sdl_renderer, texture_hunter.texture, NULL, &sdl_rect, 0.0, NULL, SDL_FLIP_HORIZONTAL);
-  }
+  dump_profile=0;
+  collision_bench=0;
+  rounds=1000;
+  seed=1;
+  players=1;
+  SCREEN_WIDTH=1024;
+  SCREEN_HEIGHT=600;
   
-  // Render ducks
-  for(i=0; i<ducks_size; i++)
+  // Read command line options
+  for(i=1; i<argc; i++)
   {
-    if(ducks[i].enabled)
+    if(strcmp(args[i], "--rounds")==0 && i+1<argc)
     {
-      if(ducks[i].vx!=0 && ducks[i].vy==0)
-      {
-	sdl_rect.x=130+(frames/10%3*40);
-	sdl_rect.y=120;
-      }
-      else if(ducks[i].vx==0 && ducks[i].vy==0)
-      {
-	sdl_rect.x=131;
-	sdl_rect.y=238;
-      }
-      else if(ducks[i].vx==0 && ducks[i].vy>0)
+      rounds=atoi(args[++i]);
+    }
+    else if(strcmp(args[i], "--players")==0 && i+1<argc)
+    {
+      players=atoi(args[++i]);
+      if(players < 1 || players > MAX_PLAYERS)
       {
-	sdl_rect.x=178;
-	sdl_rect.y=237;
+	printf("Players must be between 1 and %d\n", MAX_PLAYERS);
+	exit(-1);
       }
-      sdl_rect.w=DUCK_WIDTH;
-      sdl_rect.h=DUCK_HEIGHT;
-      sdl_rect2.x=ducks[i].x;
-      sdl_rect2.y=ducks[i].y;
-      sdl_rect2.w=duck_width;
-      sdl_rect2.h=duck_height;      
-      SDL_RenderCopyEx(sdl_renderer, texture_sprites.texture, &sdl_rect,  &sdl_rect2, 0.0, NULL, ducks[i].vx>0 ? SDL_FLIP_NONE : SDL_FLIP_HORIZONTAL);
+      players_max=players>2 ? players : 2;
     }
-  }
-  
-  // Render fired bullets
-  SDL_SetRenderDrawColor(sdl_renderer, 0x00, 0x00, 0x00, 0xFF );  
-  for(i=0; i<BULLETS_SIZE; i++)
-  {
-    if(bullets[i].enabled)
+    else if(strcmp(args[i], "--tick-rate")==0 && i+1<argc)
     {
-      sdl_rect.x=bullets[i].x;
-      sdl_rect.y=bullets[i].y;
-      sdl_rect.w=4;
-      sdl_rect.h=4;
-      SDL_RenderFillRect(sdl_renderer, &sdl_rect);
+      sim_rate=atoi(args[++i]);
     }
-  }
-  
-  // Render bullets remaining
-  sdl_rect.y=SCREEN_HEIGHT - texture_bulllet.height-10;
-  sdl_rect.w=texture_bulllet.width;
-  sdl_rect.h=texture_bulllet.height;  
-  for(j=0; j<players; j++)
-  {
-    for(i=0; i<shotgun[j].magazine; i++)
-    {    
-      if(j==0)
-      {
-	sdl_rect.x=10*i;
-      }
-      else
+    else if(strcmp(args[i], "--seed")==0 && i+1<argc)
+    {
+      seed=atoi(args[++i]);
+    }
+    else if(strcmp(args[i], "--script")==0 && i+1<argc)
+    {
+      load_script(args[++i]);
+    }
+    else if(strcmp(args[i], "--fire-interval")==0 && i+1<argc)
+    {
+      fire_interval=atoi(args[++i]);
+    }
+    else if(strcmp(args[i], "--size")==0 && i+1<argc)
+    {
+      sscanf(args[++i], "%dx%d", &SCREEN_WIDTH, &SCREEN_HEIGHT);
+    }
+    else if(strcmp(args[i], "--profile")==0 && i+1<argc)
+    {
+      profile_prefix=args[++i];
+      dump_profile=1;
+    }
+    else if(strcmp(args[i], "--collision-bench")==0)
+    {
+      collision_bench=1;
+    }
+    else if(strcmp(args[i], "--tick-rates")==0 && i+1<argc)
+    {
+      // Comma separated, the first one is the reference
+      for(rate=strtok(args[++i], ","); rate != NULL && check_rates_count < MAX_CHECK_RATES; rate=strtok(NULL, ","))
       {
-	sdl_rect.x=SCREEN_WIDTH-25-10*i;
+	check_rates[check_rates_count++]=atoi(rate);
       }
-      SDL_RenderCopy(sdl_renderer, texture_bulllet.texture, NULL, &sdl_rect);
+    }
+    else if((consumed=process_arg(argc, args, i)) > 0)
+    {
+      i+=consumed-1;
+    }
+    else
+    {
+      printf("Usage: %s [--rounds n] [--players 1-8] [--tick-rate n] [--seed n] [--script file] [--fire-interval n] [--size WxH] [--profile output_prefix] [--collision-bench] [--tick-rates n,n,...]", args[0]);
+      print_game_options();
+      printf("\n");
+      exit(-1);
     }
   }
-  
-  // Render ducks counter
-  sdl_color.r=0;
-  sdl_color.g=0;
-  sdl_color.b=0;
-  sdl_color.a=255;
-  sdl_rect.x=130;
-  sdl_rect.y=120;
-  sdl_rect.w=DUCK_WIDTH;
-  sdl_rect.h=DUCK_HEIGHT;
-  sdl_rect2.x=60;
-  sdl_rect2.y=SCREEN_HEIGHT - DUCK_HEIGHT - 10;
-  sdl_rect2.w=DUCK_WIDTH;
-  sdl_rect2.h=DUCK_HEIGHT;
-  SDL_RenderCopy(sdl_renderer, texture_sprites.texture, &sdl_rect, &sdl_rect2);
-  if(players==2)
+  if(sim_rate < 10 || fire_interval < 1)
   {
-    sdl_rect2.x=SCREEN_WIDTH-200;
-    SDL_RenderCopy(sdl_renderer, texture_sprites.texture, &sdl_rect, &sdl_rect2);
+    printf("Invalid tick rate or fire interval\n");
+    exit(-1);
   }
-  
-  sprintf(p1_score_s, "%02d", hunters[0].score);
-  sprintf(p2_score_s, "%02d", hunters[1].score);
-  
-  sdl_rect.x=100;
-  sdl_rect.y=SCREEN_HEIGHT - 49;
-    
-  loadTFTTexture(&texture_text_p1, font_small, p1_score_s, sdl_color);
-  sdl_rect.w=texture_text_p1.width;
-  sdl_rect.h=texture_text_p1.height;
-  SDL_RenderCopy(sdl_renderer, texture_text_p1.texture, NULL, &sdl_rect);
-  SDL_DestroyTexture(texture_text_p1.texture);
-  
-  if(players==2)
+  for(i=0; i<check_rates_count; i++)
   {
-    sdl_rect.x=SCREEN_WIDTH-150;
-    loadTFTTexture(&texture_text_p1, font_small, p2_score_s, sdl_color);
-    sdl_rect.w=texture_text_p1.width;
-    sdl_rect.h=texture_text_p1.height;
-    SDL_RenderCopy(sdl_renderer, texture_text_p1.texture, NULL, &sdl_rect);
-    SDL_DestroyTexture(texture_text_p1.texture);
+    if(check_rates[i] < 10)
+    {
+      printf("Invalid tick rate %d\n", check_rates[i]);
+      exit(-1);
+    }
   }
-  
-  // Draw render time
-  sprintf(render_time_s, "%ums %2.1fC", render_time, temperature);
-  loadTFTTexture(&texture_render_time, font_roboto, render_time_s, sdl_color);
-  sdl_rect.w=texture_render_time.width;
-  sdl_rect.h=texture_render_time.height;
-  sdl_rect.x=SCREEN_WIDTH-sdl_rect.w-5;
-  sdl_rect.y=SCREEN_HEIGHT-sdl_rect.h-5;
-  SDL_RenderCopy(sdl_renderer, texture_render_time.texture, NULL, &sdl_rect);
-  SDL_DestroyTexture(texture_render_time.texture);
-  
-  
-  // Render game game  over
-  if(game_over)
+  if(check_rates_count > 0 && script_size > 0)
   {
-    loadTFTTexture(&texture_game_over, font_big, "GAME OVER", sdl_color);
-    sdl_rect.x=SCREEN_WIDTH/2-texture_game_over.width/2;
-    sdl_rect.y=SCREEN_HEIGHT/2-texture_game_over.height/2;
-    sdl_rect.w=texture_game_over.width;
-    sdl_rect.h=texture_game_over.height;  
-    SDL_RenderCopy(sdl_renderer, texture_game_over.texture, NULL, &sdl_rect);
-    SDL_DestroyTexture(texture_game_over.texture);
+    printf("The rate check only plays with autoplay, scripts are in ticks\n");
+    exit(-1);
   }
   
-  // Render pause
-  if(pause)
-  {
-    loadTFTTexture(&texture_game_over, font_big, "PAUSE", sdl_color);
-    sdl_rect.x=SCREEN_WIDTH/2-texture_game_over.width/2;
-    sdl_rect.y=SCREEN_HEIGHT/2-texture_game_over.height/2;
-    sdl_rect.w=texture_game_over.width;
-    sdl_rect.h=texture_game_over.height;  
-    SDL_RenderCopy(sdl_renderer, texture_game_over.texture, NULL, &sdl_rect);
-    SDL_DestroyTexture(texture_game_over.texture);
-  }
+  // Null renderer: sizes come from constants, no window, mixer or joysticks
+  srand(seed);
+  texture_hunter.width=HUNTER_WIDTH;
+  texture_hunter.height=HUNTER_HEIGHT;
+  perf_frequency=SDL_GetPerformanceFrequency();
+  init_profile();
+  memset(&round_update, 0, sizeof(round_update));
+  round_update.name="round";
+  frames=0;
+  pause=0;
+  players_menu=0;
   
-  // Play quacks
-  if(!game_over && frames%90==0)
+  // Collision scaling benchmark instead of rounds
+  if(collision_bench)
   {
-    Mix_PlayChannel(-1, quack_chunk, 0);
+    run_collision_bench();
+    return 0;
   }
   
-  //Update screen
-  SDL_RenderPresent(sdl_renderer);
-}
-
-
-void process_axis(int controller, int axis, int value)
-{
-}
-
-void process_button_down(int controller, int button)
-{
-  switch(button) 
+  // Scores compared across tick rates instead of rounds
+  if(check_rates_count > 0)
   {
-    // Fire
-    case BUTTON_A: case BUTTON_R1: case BUTTON_R2: fire(controller); break;
-    case BUTTON_X: fire(controller+1); break;
-    case BUTTON_Y: cock(controller+1); break;
-    // Reload
-    case BUTTON_B: case BUTTON_L1: cock(controller); break;
-    case BUTTON_SELECT: process_select_button(); break;
-    case BUTTON_START: process_start_button(); break;    
+    run_rate_check(rounds);
+    return 0;
   }
-}
-void process_button_up(int controller, int button)
-{
-}
-
-
-void fire(int player)
-{
-  struct bullet current;
-  int i;
-  
-  if(game_over) return;
   
-  if(players==1 && player==1) return;
-  
-  if(shotgun[player].magazine>0)
+  // Run rounds at uncapped speed
+  ticks=0;
+  memset(total_score, 0, sizeof(total_score));
+  checksum=seed;
+  start=SDL_GetPerformanceCounter();
+  for(round=0; round<rounds; round++)
   {
-    current.y=hunters[player].y;
-    current.player=player;
-    
-    if(player==0)
+    game_over=0;
+    init_game();
+    round_start=frames;
+    round_counter=SDL_GetPerformanceCounter();
+    while(!game_over && frames-round_start < MAX_ROUND_TICKS)
     {
-      current.x=hunters[player].x + hunter_width;
-      current.vx=speed_bullet*cos(ANGLE_BULLET);
-    }    
-    else if(player==1)
+      scripted_input(frames-round_start);
+      frames++;
+      update_game();
+    }
+    histogram_add(&round_update, (SDL_GetPerformanceCounter() - round_counter) * 1000000 / perf_frequency);
+    ticks+=frames-round_start;
+    for(p=0; p<players; p++)
     {
-      current.x=hunters[player].x;
-      current.vx=-speed_bullet*cos(ANGLE_BULLET);
+      total_score[p]+=hunters[p].score;
     }
-    current.vy=-1.0*speed_bullet*sin(ANGLE_BULLET);
-    
-    // Insert bullet in array
-    for(i=0; i<BULLETS_SIZE; i++)
+    // Same value as with two players before, the others are chained on
+    checksum=checksum*31+hunters[0].score*1000+hunters[1].score+(frames-round_start);
+    for(p=2; p<players; p++)
     {
-      if(!bullets[i].enabled)
-      {
-	bullets[i]=current;
-	bullets[i].enabled=1;
-	shotgun[player].magazine--;
-	Mix_PlayChannel(-1, fire_chunk, 0);
-	break;
-      }
+      checksum=checksum*31+hunters[p].score;
     }
   }
-  else
-  {
-    Mix_PlayChannel(-1, fire_dry_chunk, 0);
-  }
-}
-
-void cock(int player)
-{
-  if(game_over) return;
-  shotgun[player].magazine=0;
-  Mix_PlayChannel(-1, cocking_chunk, 0);
-  shotgun[player].cocking_time=frames+30;
-}
-
-void process_start_button()
-{
-  if(game_over)
+  end=SDL_GetPerformanceCounter();
+  
+  // Report throughput
+  seconds=(double)(end-start)/perf_frequency;
+  printf("{\"kernels\": \"%s\", \"rounds\": %u, \"ticks\": %u, \"seconds\": %.3f, \"rounds_per_second\": %.1f, \"ticks_per_second\": %.1f, "
+	 "\"score_p1\": %u, \"score_p2\": %u, \"scores\": [",
+	 kernels.name, rounds, ticks, seconds, rounds/seconds, ticks/seconds, total_score[0], total_score[1]);
+  for(p=0; p<players; p++)
   {
-    game_over=0;
-    pause=0;
-    init_game();
+    printf(p>0 ? ", %u" : "%u", total_score[p]);
   }
-  else
+  printf("], \"checksum\": %u, \"round_update\": ", checksum);
+  histogram_write_json(stdout, &round_update);
+  printf("}\n");
+  if(dump_profile)
   {
-    pause=!pause;
+    profile_ticks=frames;
+    profile_dump();
   }
+  
+  free(script);
+  return 0;
 }
-
-void process_select_button()
-{
-}
-
-
-
-
-
-
-
-
-
-
-
-
+#endif